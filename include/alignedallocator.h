@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdlib>
+#include <new>
+
+template<typename T, size_t Alignment>
+struct AlignedAllocator {
+	using value_type = T;
+
+	template<typename U>
+	struct rebind {
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	inline T* allocate(size_t n) {
+		void* ptr = nullptr;
+
+		if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) {
+			throw std::bad_alloc();
+		}
+
+		return static_cast<T*>(ptr);
+	}
+
+	inline void deallocate(T* ptr, size_t) {
+		free(ptr);
+	}
+
+	template<typename U>
+	inline bool operator==(const AlignedAllocator<U, Alignment>&) const {
+		return true;
+	}
+
+	template<typename U>
+	inline bool operator!=(const AlignedAllocator<U, Alignment>&) const {
+		return false;
+	}
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+// non owning view of a contiguous array
+template<typename T>
+struct ArrayView {
+	T* ptr = nullptr;
+	size_t count = 0;
+
+	inline T& operator[](size_t i) const {
+		return ptr[i];
+	}
+
+	inline T* data() const {
+		return ptr;
+	}
+
+	inline size_t size() const {
+		return count;
+	}
+
+	inline bool empty() const {
+		return count == 0;
+	}
+
+	inline T* begin() const {
+		return ptr;
+	}
+
+	inline T* end() const {
+		return ptr + count;
+	}
+};
@@ -3,6 +3,8 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
+#include <limits>
+
 #include "triangle.h"
 
 struct BoundingBox {
@@ -20,6 +22,27 @@ struct BoundingBox {
 		return expand(fromTriangle(triangle));
 	}
 
+	inline glm::vec3 centroid() const {
+		return (min + max) * 0.5f;
+	}
+
+	inline float area() const {
+		glm::vec3 d = max - min;
+
+		if (d.x < 0 || d.y < 0 || d.z < 0) {
+			return 0;
+		}
+
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	inline static BoundingBox empty() {
+		return {
+			glm::vec3 { std::numeric_limits<float>::max() },
+			glm::vec3 { -std::numeric_limits<float>::max() }
+		};
+	}
+
 	inline static BoundingBox fromTriangle(const Triangle& triangle) {
 		return {
 			glm::min(glm::min(triangle.v0->pos, triangle.v1->pos), triangle.v2->pos),
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+struct BuildParams {
+	enum class Builder { Median, Sah, Bvh, Lbvh, Sbvh };
+
+	Builder builder = Builder::Sah;
+
+	// SAH costs, only their ratio matters
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.5f;
+
+	// a node is only made a leaf once it holds at most maxLeafSize triangles
+	// and splitting it is not expected to pay off, or when maxDepth is reached.
+	// The median builder always splits down to maxLeafSize triangles
+	size_t maxLeafSize = 8;
+	int maxDepth = 48;
+
+	// centroid bins per axis of the binned SAH bvh builder, at most 64
+	int binCount = 16;
+
+	// morton code length of the linear bvh builder, 30 or 63 bits, and how many of its
+	// top subtrees get rebuilt with a full SAH sweep, 0 keeps the plain morton hierarchy
+	int mortonBits = 30;
+	size_t lbvhSahClusters = 0;
+
+	// spatial splits are only tried where the children of the best object split overlap
+	// by more than sbvhAlpha times the root surface area
+	float sbvhAlpha = 1e-5f;
+
+	// treelet restructuring passes over the finished tree, only subtrees holding at least
+	// treeletMinTriangles triangles get restructured
+	int treeletPasses = 0;
+	size_t treeletMinTriangles = 32;
+
+	// a scene reusing the previous model and tree settings refits the previous tree instead of
+	// building a new one, unless that raises its SAH cost above refitThreshold times its cost
+	// when built. 0 always rebuilds, and so do sah kd-trees, see canRefit
+	float refitThreshold = 1.25f;
+
+	// children per node of the tree traversed while rendering, 2, 4 or 8. Wider trees are collapsed
+	// from the built binary tree, which is what gets refitted and cached
+	int treeWidth = 4;
+
+	// bits per child bound of wide tree nodes. 32 keeps floats, 16 or 8 quantize them relative to the node,
+	// which shrinks a 4 wide node to 96 or 64 bytes and an 8 wide one to 160 or 128
+	int nodeBits = 32;
+
+	// subtrees and top level sweeps are only built in parallel above parallelCutoff triangles,
+	// the resulting tree does not depend on threadCount
+	unsigned threadCount = 1;
+	size_t parallelCutoff = 4096;
+
+	inline bool buildsBvh() const {
+		return builder == Builder::Bvh || builder == Builder::Lbvh || builder == Builder::Sbvh;
+	}
+
+	// kd cells clip the triangles they reference, refitting them to whole triangles undoes every cut
+	inline bool canRefit() const {
+		return refitThreshold > 0 && builder != Builder::Sah;
+	}
+
+	// whether both settings build the same tree out of the same triangles
+	inline bool buildsSameTree(const BuildParams& other) const {
+		return builder == other.builder && traversalCost == other.traversalCost && intersectionCost == other.intersectionCost
+			&& maxLeafSize == other.maxLeafSize && maxDepth == other.maxDepth && binCount == other.binCount
+			&& mortonBits == other.mortonBits && lbvhSahClusters == other.lbvhSahClusters && sbvhAlpha == other.sbvhAlpha
+			&& treeletPasses == other.treeletPasses && treeletMinTriangles == other.treeletMinTriangles;
+	}
+
+	inline static Builder parseBuilder(const std::string& name) {
+		if (name == "median") return Builder::Median;
+		if (name == "sah") return Builder::Sah;
+		if (name == "bvh") return Builder::Bvh;
+		if (name == "lbvh") return Builder::Lbvh;
+		if (name == "sbvh") return Builder::Sbvh;
+
+		throw std::runtime_error("unknown builder '" + name + "'!");
+	}
+
+	inline static const char* builderName(Builder builder) {
+		switch (builder) {
+			case Builder::Median: return "median";
+			case Builder::Sah: return "sah";
+			case Builder::Bvh: return "bvh";
+			case Builder::Lbvh: return "lbvh";
+			case Builder::Sbvh: return "sbvh";
+		}
+
+		return "unknown";
+	}
+};
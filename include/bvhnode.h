@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "boundingbox.h"
+#include "buildparams.h"
+#include "triangle.h"
+
+struct BvhNode {
+	BoundingBox bbox;
+	std::unique_ptr<BvhNode> left;
+	std::unique_ptr<BvhNode> right;
+	uint32_t offset = 0; // leaf triangle range in the reordered triangle array
+	uint32_t count = 0;
+	int axis = 0;
+	float cost = 0; // unnormalized SAH cost of the subtree, only kept up to date by the treelet optimizer
+
+	// binned surface area heuristic over triangle centroids
+	static std::unique_ptr<BvhNode> buildBinned(std::vector<Triangle>& triangles, const BuildParams& params);
+
+	// linear bvh over radix sorted morton codes of the triangle centroids
+	static std::unique_ptr<BvhNode> buildLbvh(std::vector<Triangle>& triangles, const BuildParams& params);
+
+	// spatial split bvh, triangles straddling a split are referenced from both children
+	static std::unique_ptr<BvhNode> buildSbvh(std::vector<Triangle>& triangles, const BuildParams& params);
+
+	// every builder reorders triangles so that each leaf references a contiguous range,
+	// the spatial split builder may also grow it with duplicated references
+	static std::unique_ptr<BvhNode> build(std::vector<Triangle>& triangles, const BuildParams& params);
+};
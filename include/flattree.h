@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "alignedallocator.h"
+#include "arrayview.h"
+#include "boundingbox.h"
+#include "buildparams.h"
+#include "triangle.h"
+
+// two nodes per cache line, the first child of an interior node always directly follows it
+struct alignas(32) FlatNode {
+	BoundingBox bbox;
+	uint32_t offset; // second child for interior nodes, first triangle for leaves
+	uint16_t count; // triangles in the leaf, 0 for interior nodes
+	uint16_t axis;
+
+	inline bool isLeaf() const {
+		return count > 0;
+	}
+};
+
+static_assert(sizeof(FlatNode) == 32, "FlatNode should be half a cache line");
+
+struct MappedFile;
+
+// holds no pointer, so that it can be mapped from a cache file as is
+struct FlatTree {
+	// what traversal reads, either the storage below or a mapped cache file
+	ArrayView<FlatNode> nodes;
+	ArrayView<uint32_t> triangles; // triangle of every leaf reference, in leaf order
+	ArrayView<const Vertex> vertices; // three per triangle
+	ArrayView<TriangleRecord> records; // intersection data of every leaf reference
+
+	std::vector<FlatNode, AlignedAllocator<FlatNode, 64>> nodeStorage;
+	std::vector<uint32_t> triangleStorage;
+	std::vector<TriangleRecord, AlignedAllocator<TriangleRecord, 64>> recordStorage;
+	std::shared_ptr<MappedFile> mapping;
+
+	FlatTree() = default;
+	FlatTree(const FlatTree&) = delete;
+	FlatTree(FlatTree&&) = default;
+	FlatTree& operator=(const FlatTree&) = delete;
+	FlatTree& operator=(FlatTree&&) = default;
+
+	// triangles must already be reordered so that every leaf is a contiguous range, and point into vertices
+	template<typename Node>
+	static FlatTree flatten(const Node& root, const std::vector<Triangle>& triangles, ArrayView<const Vertex> vertices) {
+		FlatTree tree;
+		tree.vertices = vertices;
+
+		tree.triangleStorage.resize(triangles.size());
+		for (size_t i=0; i<triangles.size(); ++i) {
+			tree.triangleStorage[i] = static_cast<uint32_t>((triangles[i].v0 - vertices.data()) / 3);
+		}
+
+		// an empty model leaves the tree without any node
+		if (root.left || root.count > 0) {
+			tree.flattenNode(root);
+		}
+
+		tree.recordStorage.resize(triangles.size());
+
+		tree.nodes = { tree.nodeStorage.data(), tree.nodeStorage.size() };
+		tree.triangles = { tree.triangleStorage.data(), tree.triangleStorage.size() };
+		tree.records = { tree.recordStorage.data(), tree.recordStorage.size() };
+		tree.updateRecords();
+
+		return tree;
+	}
+
+	inline Triangle triangle(size_t reference) const {
+		const Vertex* v = &vertices[3 * static_cast<size_t>(triangles[reference])];
+		return { v, v + 1, v + 2 };
+	}
+
+	// recomputes the intersection data of every reference from the vertices
+	void updateRecords();
+
+	// recomputes every bound and record after the triangles moved, keeping the topology
+	void refit();
+
+	// SAH cost of the whole tree normalized by the root surface area
+	float sahCost(const BuildParams& params) const;
+
+	inline size_t memoryUsage() const {
+		return nodes.size() * sizeof(FlatNode) + triangles.size() * (sizeof(uint32_t) + sizeof(TriangleRecord));
+	}
+
+private:
+	// the most triangles count can hold
+	static constexpr uint32_t maxLeafTriangles = 0xFFFF;
+
+	template<typename Node>
+	void flattenNode(const Node& node) {
+		if (!node.left) {
+			flattenLeaf(node.bbox, node.offset, node.count, static_cast<uint16_t>(node.axis));
+			return;
+		}
+
+		size_t index = nodeStorage.size();
+		nodeStorage.emplace_back();
+		nodeStorage[index].bbox = node.bbox;
+		nodeStorage[index].axis = static_cast<uint16_t>(node.axis);
+
+		flattenNode(*node.left);
+		nodeStorage[index].offset = static_cast<uint32_t>(nodeStorage.size());
+		nodeStorage[index].count = 0;
+		flattenNode(*node.right);
+	}
+
+	// leaves the depth limit or inseparable triangles made too large for count are split at the
+	// median centroid until they fit, their bounds kept within bbox since kd leaves hold clipped triangles
+	void flattenLeaf(const BoundingBox& bbox, uint32_t offset, uint32_t count, uint16_t axis);
+};
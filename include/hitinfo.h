@@ -3,11 +3,13 @@
 #include "triangle.h"
 
 #include <limits>
+#include <cstdint>
 
 struct HitInfo {
 	float t = std::numeric_limits<float>::max();
 	float u, v;
-	Triangle const* triangle;
+	uint32_t reference; // leaf reference of the closest triangle during traversal
+	Triangle triangle; // only set once traversal is done
 
 	inline operator bool() {
 		return t < std::numeric_limits<float>::max();
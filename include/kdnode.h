@@ -4,13 +4,29 @@
 #include <memory>
 
 #include "boundingbox.h"
+#include "buildparams.h"
 #include "triangle.h"
 
 struct KdNode {
 	BoundingBox bbox;
 	std::unique_ptr<KdNode> left;
 	std::unique_ptr<KdNode> right;
-	Triangle triangle;
+	uint32_t offset = 0; // leaf triangle range in the reordered triangle array
+	uint32_t count = 0;
+	int axis = 0;
+	float cost = 0; // unnormalized SAH cost of the subtree, only kept up to date by the treelet optimizer
 
-	KdNode(std::vector<Triangle>::iterator begin, std::vector<Triangle>::iterator end, int depth=0);
+	KdNode() = default;
+
+	// median split on a round robin axis, down to maxLeafSize triangles per leaf
+	KdNode(std::vector<Triangle>& triangles, size_t begin, size_t end, const BuildParams& params, unsigned threads=1, int depth=0);
+
+	// surface area heuristic kd-tree over the sorted start and end events of the triangle bounds, O(n log n).
+	// Node bounds are the kd cells, triangles straddling a split plane are clipped to both cells and
+	// referenced from both, and splits leaving one side empty just shrink the cell
+	static std::unique_ptr<KdNode> buildSah(std::vector<Triangle>& triangles, const BuildParams& params);
+
+	// both builders reorder triangles so that every leaf references a contiguous range,
+	// the SAH builder may also grow it with duplicated references
+	static std::unique_ptr<KdNode> build(std::vector<Triangle>& triangles, const BuildParams& params);
 };
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "ray.h"
+#include "raypacket.h"
+#include "flattree.h"
+#include "widetree.h"
+#include "hitinfo.h"
+
+// the single ray and packet queries of one kind of tree
+template<typename Tree>
+struct TreeKernels {
+	bool (*intersect)(const Ray& ray, const Tree& tree, HitInfo& hitInfo);
+	bool (*occluded)(const Ray& ray, const Tree& tree, float tmax);
+
+	bool (*intersectPacket4)(RayPacket<4>& packet, const Tree& tree, HitInfo* hitInfos);
+	bool (*intersectPacket16)(RayPacket<16>& packet, const Tree& tree, HitInfo* hitInfos);
+	bool (*intersectPacket64)(RayPacket<64>& packet, const Tree& tree, HitInfo* hitInfos);
+
+	inline bool intersectPacket(RayPacket<4>& packet, const Tree& tree, HitInfo* hitInfos) const {
+		return intersectPacket4(packet, tree, hitInfos);
+	}
+
+	inline bool intersectPacket(RayPacket<16>& packet, const Tree& tree, HitInfo* hitInfos) const {
+		return intersectPacket16(packet, tree, hitInfos);
+	}
+
+	inline bool intersectPacket(RayPacket<64>& packet, const Tree& tree, HitInfo* hitInfos) const {
+		return intersectPacket64(packet, tree, hitInfos);
+	}
+};
+
+// traversal and intersection compiled for one instruction set, every query of Ray and RayPacket
+// runs through the active table
+struct Kernels {
+	const char* name;
+	bool (*supported)();
+
+	TreeKernels<FlatTree> flatTree;
+	TreeKernels<WideTree<4>> wideTree4;
+	TreeKernels<WideTree<8>> wideTree8;
+	TreeKernels<WideTree<4, uint8_t>> wideTree4x8;
+	TreeKernels<WideTree<4, uint16_t>> wideTree4x16;
+	TreeKernels<WideTree<8, uint8_t>> wideTree8x8;
+	TreeKernels<WideTree<8, uint16_t>> wideTree8x16;
+
+	template<int Width, typename Bound>
+	const TreeKernels<WideTree<Width, Bound>>& wideTree() const;
+
+	// the best variant this cpu supports until select is called
+	static const Kernels* active;
+
+	// every variant compiled in, from the most to the least capable
+	static std::vector<const Kernels*> variants();
+
+	// an empty name picks the best supported variant, unknown and unsupported ones throw
+	static void select(const std::string& name);
+};
+
+template<> inline const TreeKernels<WideTree<4>>& Kernels::wideTree<4, float>() const { return wideTree4; }
+template<> inline const TreeKernels<WideTree<8>>& Kernels::wideTree<8, float>() const { return wideTree8; }
+template<> inline const TreeKernels<WideTree<4, uint8_t>>& Kernels::wideTree<4, uint8_t>() const { return wideTree4x8; }
+template<> inline const TreeKernels<WideTree<4, uint16_t>>& Kernels::wideTree<4, uint16_t>() const { return wideTree4x16; }
+template<> inline const TreeKernels<WideTree<8, uint8_t>>& Kernels::wideTree<8, uint8_t>() const { return wideTree8x8; }
+template<> inline const TreeKernels<WideTree<8, uint16_t>>& Kernels::wideTree<8, uint16_t>() const { return wideTree8x16; }
+
+extern const Kernels baselineKernels;
+extern const Kernels avx2Kernels;
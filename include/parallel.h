@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "threadpool.h"
+
+// runs f on the calling thread, then waits for the tasks of group, which reference its stack even when f throws
+template<typename F>
+inline void runThenWait(ThreadPool* pool, TaskGroup& group, F f) {
+	try {
+		f();
+	} catch (...) {
+		if (pool) {
+			try {
+				pool->wait(group);
+			} catch (...) {}
+		}
+		throw;
+	}
+
+	if (pool) {
+		pool->wait(group);
+	}
+}
+
+// splits [begin, end) into at most threadCount contiguous chunks and runs f(chunkBegin, chunkEnd, chunkIndex)
+// on each of them, the calling thread takes the first chunk. Returns the number of chunks used.
+template<typename F>
+inline size_t parallelFor(size_t begin, size_t end, unsigned threadCount, F f) {
+	size_t count = end - begin;
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, count));
+	size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	ThreadPool* pool = ThreadPool::global;
+	TaskGroup group;
+
+	for (size_t chunk=1; chunk<chunkCount; ++chunk) {
+		size_t chunkBegin = std::min(end, begin + chunk * chunkSize);
+		size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+
+		if (pool) {
+			pool->submit(group, [&f, chunkBegin, chunkEnd, chunk] { f(chunkBegin, chunkEnd, chunk); });
+		} else {
+			f(chunkBegin, chunkEnd, chunk);
+		}
+	}
+
+	runThenWait(pool, group, [&] { f(begin, std::min(end, begin + chunkSize), size_t(0)); });
+
+	return chunkCount;
+}
+
+// runs a and b, forking b onto another thread of the pool when fork is set
+template<typename A, typename B>
+inline void parallelInvoke(bool fork, A a, B b) {
+	ThreadPool* pool = ThreadPool::global;
+
+	if (fork && pool) {
+		TaskGroup group;
+		pool->submit(group, [&b] { b(); });
+		runThenWait(pool, group, a);
+	} else {
+		a();
+		b();
+	}
+}
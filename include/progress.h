@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alignedallocator.h"
+
+// counts finished work per thread, each counter on a cache line of its own and only ever written
+// by its thread, and reports the sum from a thread of its own every interval
+class Progress {
+public:
+	enum class Mode { Bar, Machine, Off };
+
+	// Bar redraws a percentage in place, Machine prints one line per report:
+	// "progress <label> percent=<p> rays_per_second=<r> eta_seconds=<s>"
+	Progress(Mode mode, const std::string& label, size_t total, unsigned slots, std::chrono::milliseconds interval);
+
+	// stops the reporter after a last report
+	~Progress();
+
+	Progress(const Progress&) = delete;
+	Progress& operator=(const Progress&) = delete;
+
+	// called only by the thread owning slot
+	inline void add(unsigned slot, size_t amount) {
+		std::atomic_size_t& count = counters[slot].count;
+		count.store(count.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	inline static Mode parseMode(const std::string& name) {
+		if (name == "bar") return Mode::Bar;
+		if (name == "machine") return Mode::Machine;
+		if (name == "off") return Mode::Off;
+
+		throw std::runtime_error("unknown progress mode '" + name + "'!");
+	}
+
+private:
+	struct alignas(64) Counter {
+		std::atomic_size_t count { 0 };
+	};
+
+	Mode mode;
+	std::string label;
+	size_t total;
+	std::vector<Counter, AlignedAllocator<Counter, 64>> counters;
+
+	std::chrono::milliseconds interval;
+	std::chrono::steady_clock::time_point start;
+
+	std::mutex stopMutex;
+	std::condition_variable stopped;
+	bool stopping = false;
+	std::thread reporter;
+
+	size_t done() const;
+	void report(size_t done);
+	void reporterLoop();
+};
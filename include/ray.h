@@ -5,14 +5,36 @@
 
 #include "triangle.h"
 #include "boundingbox.h"
-#include "kdnode.h"
+#include "flattree.h"
+#include "widetree.h"
 #include "hitinfo.h"
 
 struct Ray {
 	glm::vec3 orig;
 	glm::vec3 dir;
 
-	bool intersectTriangle(const Triangle& triangle, HitInfo& hitInfo) const;
-	bool intersectKdNode(KdNode* node, HitInfo& hitInfo) const;
-	bool intersectBoundingBox(const BoundingBox& bbox) const;
+	// what every box test shares, sign[axis] is 1 where dir is negative
+	glm::vec3 invDir;
+	int sign[3];
+
+	Ray(const glm::vec3& orig, const glm::vec3& dir) : orig(orig), dir(dir), invDir(1.0f / dir) {
+		for (int axis=0; axis<3; ++axis) {
+			sign[axis] = dir[axis] < 0;
+		}
+	}
+
+	// node stack of the iterative traversal, enough for every tree built within maxDepth
+	static constexpr int stackSize = 64;
+
+	bool intersectFlatTree(const FlatTree& tree, HitInfo& hitInfo) const;
+
+	// closest hit through a 4 or 8 wide tree, children are tested together and visited nearest first
+	template<int Width, typename Bound>
+	bool intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo& hitInfo) const;
+
+	// whether anything lies on the ray between 0 and tmax, from either side. Stops at the first
+	// intersection found, without ordering children or computing where it was
+	bool occluded(const FlatTree& tree, float tmax) const;
+	template<int Width, typename Bound>
+	bool occluded(const WideTree<Width, Bound>& tree, float tmax) const;
 };
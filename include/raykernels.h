@@ -0,0 +1,1170 @@
+// the hot loops of rendering, without include guard on purpose. Every src/kernels*.cpp compiles
+// them once for its own instruction set, after including kernels.h and defining KERNEL_TABLE,
+// KERNEL_NAME and KERNEL_SUPPORTED. KERNEL_SSE2 and KERNEL_AVX enable the 4 and 8 wide code paths.
+// Everything but the table has internal linkage, so the copies never clash
+
+namespace {
+
+// a ray with the queries it runs, the public Ray only forwards to the active kernels
+struct Tracer : Ray {
+	explicit Tracer(const Ray& ray) : Ray(ray) {}
+
+	bool intersectTriangle(const TriangleRecord& triangle, uint32_t reference, HitInfo& hitInfo) const;
+	bool occludedBy(const TriangleRecord& triangle, float tmax) const;
+
+	// [tnear, tfar] is the part of the ray inside the box, clipped to [0, tmax]
+	bool intersectBoundingBox(const BoundingBox& bbox, float tmax, float& tnear, float& tfar) const;
+
+	bool intersectFlatTree(const FlatTree& tree, HitInfo& hitInfo) const;
+	bool occluded(const FlatTree& tree, float tmax) const;
+
+	template<int Width, typename Bound>
+	bool intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo& hitInfo) const;
+	template<int Width, typename Bound>
+	bool occluded(const WideTree<Width, Bound>& tree, float tmax) const;
+
+	// any hit traversal returns as soon as something occludes the ray before hitInfo.t
+	template<bool AnyHit>
+	bool traverse(const FlatTree& tree, uint32_t root, HitInfo& hitInfo) const;
+	template<bool AnyHit, int Width, typename Bound>
+	bool traverseWide(const WideTree<Width, Bound>& tree, uint32_t root, HitInfo& hitInfo) const;
+};
+
+// set bits of every 4 bit ray mask
+constexpr int groupRays[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+// a wide tree entry with the rays of a packet that entered it, bit i for ray i
+struct PacketEntry {
+	uint32_t offset;
+	uint32_t count;
+	uint64_t active;
+	float tnear; // the smallest entry distance among them
+};
+
+// a packet with the traversal state its rays share
+template<int Size>
+struct PacketTracer {
+	// subtrees entered by this few rays are left to single ray traversal
+	static constexpr int aloneRays = Size / 4;
+
+	RayPacket<Size>& packet;
+	int sign[3];
+
+	// range of the reciprocal directions over all rays, unset while some is infinite
+	bool bounded = false;
+	float invMin[3], invMax[3];
+
+	explicit PacketTracer(RayPacket<Size>& packet) : packet(packet) {
+		for (int axis=0; axis<3; ++axis) {
+			sign[axis] = packet.dir[axis][0] < 0;
+		}
+	}
+
+	// every ray of the packet, bit i for ray i
+	static constexpr uint64_t allRays = Size == 64 ? ~uint64_t(0) : (uint64_t(1) << Size) - 1;
+
+	bool intersectFlatTree(const FlatTree& tree, HitInfo* hitInfos);
+	void traverse(const FlatTree& tree, uint32_t root, uint64_t active);
+	// the rays of active entering bbox, only those are tested
+	uint64_t intersectBoundingBox(const BoundingBox& bbox, uint64_t active) const;
+	void intersectTriangle(const TriangleRecord& triangle, uint32_t reference, uint64_t active);
+
+	template<int Width, typename Bound>
+	bool intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo* hitInfos);
+	template<int Width, typename Bound>
+	void traverseWide(const WideTree<Width, Bound>& tree, const PacketEntry& root);
+	template<int Width, typename Bound>
+	void intersectWideLeaf(const WideTree<Width, Bound>& tree, const PacketEntry& entry);
+	template<int Width, typename Bound>
+	void traceAlone(const WideTree<Width, Bound>& tree, const PacketEntry& entry);
+
+	void boundDirections();
+
+	// false only if no ray of the packet can enter child i, tested once for all of them
+	template<int Width, typename Bound>
+	bool mayEnter(const WideNode<Width, Bound>& node, int i) const;
+
+	// the rays of active entering child i of node, their smallest entry distance in tnear
+	template<int Width, typename Bound>
+	uint64_t intersectChild(const WideNode<Width, Bound>& node, int i, uint64_t active, float& tnear) const;
+
+	// drops the rays whose closest hit lies before the entry, none of them can find a closer one
+	// inside. Returns how many are left
+	int cull(PacketEntry& entry) const;
+
+	template<typename Tree>
+	bool collectHits(const Tree& tree, HitInfo* hitInfos) const;
+};
+
+bool Tracer::intersectTriangle(const TriangleRecord& triangle, uint32_t reference, HitInfo& hitInfo) const {
+	const glm::vec3& v0v1 = triangle.e1;
+	const glm::vec3& v0v2 = triangle.e2;
+	glm::vec3 pvec = glm::cross(dir, v0v2);
+	float det = glm::dot(v0v1, pvec);
+
+	if (det > 0) return false; //culling
+
+	float invDet = 1 / det;
+
+	glm::vec3 tvec = orig - triangle.v0;
+	float u = glm::dot(tvec, pvec) * invDet;
+	if (u < 0 || u > 1) return false;
+
+	glm::vec3 qvec = glm::cross(tvec, v0v1);
+	float v = glm::dot(dir, qvec) * invDet;
+	if (v < 0 || u + v > 1.001f) return false;
+
+	float t = glm::dot(v0v2, qvec) * invDet;
+
+	if (t < hitInfo.t) {
+		hitInfo.t = t;
+		hitInfo.u = u;
+		hitInfo.v = v;
+		hitInfo.reference = reference;
+	}
+
+	return true;
+}
+
+bool Tracer::occludedBy(const TriangleRecord& triangle, float tmax) const {
+	glm::vec3 pvec = glm::cross(dir, triangle.e2);
+	float det = glm::dot(triangle.e1, pvec);
+
+	// both sides of a triangle occlude, only parallel rays pass
+	if (det == 0) return false;
+
+	float invDet = 1 / det;
+
+	glm::vec3 tvec = orig - triangle.v0;
+	float u = glm::dot(tvec, pvec) * invDet;
+	if (u < 0 || u > 1) return false;
+
+	glm::vec3 qvec = glm::cross(tvec, triangle.e1);
+	float v = glm::dot(dir, qvec) * invDet;
+	if (v < 0 || u + v > 1.001f) return false;
+
+	float t = glm::dot(triangle.e2, qvec) * invDet;
+	return t > 0 && t < tmax;
+}
+
+bool Tracer::intersectBoundingBox(const BoundingBox& bbox, float tmax, float& tnear, float& tfar) const {
+	const glm::vec3* bounds = &bbox.min;
+
+	float txmin = (bounds[sign[0]].x - orig.x) * invDir.x;
+	float txmax = (bounds[1 - sign[0]].x - orig.x) * invDir.x;
+	float tymin = (bounds[sign[1]].y - orig.y) * invDir.y;
+	float tymax = (bounds[1 - sign[1]].y - orig.y) * invDir.y;
+	float tzmin = (bounds[sign[2]].z - orig.z) * invDir.z;
+	float tzmax = (bounds[1 - sign[2]].z - orig.z) * invDir.z;
+
+	tnear = std::max(std::max(txmin, tymin), std::max(tzmin, 0.0f));
+	tfar = std::min(std::min(txmax, tymax), std::min(tzmax, tmax));
+
+	return tnear <= tfar;
+}
+
+bool Tracer::occluded(const FlatTree& tree, float tmax) const {
+	HitInfo hitInfo;
+	hitInfo.t = tmax;
+
+	return !tree.nodes.empty() && traverse<true>(tree, 0, hitInfo);
+}
+
+bool Tracer::intersectFlatTree(const FlatTree& tree, HitInfo& hitInfo) const {
+	if (!tree.nodes.empty()) {
+		traverse<false>(tree, 0, hitInfo);
+	}
+
+	if (hitInfo) {
+		hitInfo.triangle = tree.triangle(hitInfo.reference);
+	}
+
+	return hitInfo;
+}
+
+template<bool AnyHit>
+bool Tracer::traverse(const FlatTree& tree, uint32_t root, HitInfo& hitInfo) const {
+	uint32_t stack[stackSize];
+	int stackTop = 0;
+	uint32_t index = root;
+
+	while (true) {
+		const FlatNode& node = tree.nodes[index];
+
+		// boxes are clipped to the closest hit, nothing entered beyond it can be closer
+		float tnear, tfar;
+		if (intersectBoundingBox(node.bbox, hitInfo.t, tnear, tfar)) {
+			if (node.isLeaf()) {
+				for (uint32_t i=node.offset; i<node.offset + node.count; ++i) {
+					if (AnyHit && occludedBy(tree.records[i], hitInfo.t)) {
+						return true;
+					} else if (!AnyHit) {
+						intersectTriangle(tree.records[i], i, hitInfo);
+					}
+				}
+			} else {
+				// descend into the child on the near side of the split first, any hit does not care
+				uint32_t nearChild = index + 1, farChild = node.offset;
+				if (!AnyHit && sign[node.axis]) {
+					std::swap(nearChild, farChild);
+				}
+
+				// degenerate trees deeper than the stack continue in a nested traversal
+				if (stackTop == stackSize) {
+					if (traverse<AnyHit>(tree, farChild, hitInfo) && AnyHit) {
+						return true;
+					}
+				} else {
+					stack[stackTop++] = farChild;
+				}
+
+				index = nearChild;
+				continue;
+			}
+		}
+
+		if (stackTop == 0) {
+			return !AnyHit && hitInfo;
+		}
+		index = stack[--stackTop];
+	}
+}
+
+struct WideEntry {
+	uint32_t offset;
+	uint32_t count;
+	float tnear;
+};
+
+// sets bit i of the result for every child whose interval clipped to [0, tmax] is not empty, with its entry distance in tnear[i]
+template<int Width, typename Bound>
+unsigned intersectChildren(const WideNode<Width, Bound>& node, const Tracer& ray, float tmax, float* tnear) {
+	unsigned mask = 0;
+
+	for (int i=0; i<Width; ++i) {
+		float tmin = 0, tfar = tmax;
+
+		for (int axis=0; axis<3; ++axis) {
+			tmin = std::max(tmin, (node.bound(2 * axis + ray.sign[axis], i) - ray.orig[axis]) * ray.invDir[axis]);
+			tfar = std::min(tfar, (node.bound(2 * axis + 1 - ray.sign[axis], i) - ray.orig[axis]) * ray.invDir[axis]);
+		}
+
+		tnear[i] = tmin;
+		mask |= (tmin <= tfar) << i;
+	}
+
+	return mask;
+}
+
+#ifdef KERNEL_SSE2
+// 4 quantized bounds widened to 32 bits
+inline __m128i loadSteps(const uint8_t* steps) {
+	int bits;
+	std::memcpy(&bits, steps, sizeof(bits));
+
+	__m128i zero = _mm_setzero_si128();
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero);
+}
+
+inline __m128i loadSteps(const uint16_t* steps) {
+	return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(steps)), _mm_setzero_si128());
+}
+
+// one plane of every child, decoded exactly like WideNode::bound
+inline __m128 loadPlane(const WideNode<4>& node, int plane) {
+	return _mm_load_ps(node.bounds[plane]);
+}
+
+template<typename Bound>
+inline __m128 loadPlane(const WideNode<4, Bound>& node, int plane) {
+	__m128 steps = _mm_cvtepi32_ps(loadSteps(node.bounds[plane]));
+	return _mm_add_ps(_mm_set1_ps(node.origin[plane / 2]), _mm_mul_ps(steps, _mm_set1_ps(node.scale(plane / 2))));
+}
+
+template<typename Bound>
+unsigned intersectChildren(const WideNode<4, Bound>& node, const Tracer& ray, float tmax, float* tnear) {
+	__m128 tmin = _mm_setzero_ps();
+	__m128 tfar = _mm_set1_ps(tmax);
+
+	for (int axis=0; axis<3; ++axis) {
+		__m128 orig = _mm_set1_ps(ray.orig[axis]);
+		__m128 invDir = _mm_set1_ps(ray.invDir[axis]);
+
+		tmin = _mm_max_ps(tmin, _mm_mul_ps(_mm_sub_ps(loadPlane(node, 2 * axis + ray.sign[axis]), orig), invDir));
+		tfar = _mm_min_ps(tfar, _mm_mul_ps(_mm_sub_ps(loadPlane(node, 2 * axis + 1 - ray.sign[axis]), orig), invDir));
+	}
+
+	_mm_storeu_ps(tnear, tmin);
+	return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tmin, tfar)));
+}
+#endif
+
+#ifdef KERNEL_AVX
+inline __m256 loadPlane(const WideNode<8>& node, int plane) {
+	return _mm256_load_ps(node.bounds[plane]);
+}
+
+template<typename Bound>
+inline __m256 loadPlane(const WideNode<8, Bound>& node, int plane) {
+	__m128 lo = _mm_cvtepi32_ps(loadSteps(node.bounds[plane]));
+	__m128 hi = _mm_cvtepi32_ps(loadSteps(node.bounds[plane] + 4));
+	__m256 steps = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+
+	return _mm256_add_ps(_mm256_set1_ps(node.origin[plane / 2]), _mm256_mul_ps(steps, _mm256_set1_ps(node.scale(plane / 2))));
+}
+
+template<typename Bound>
+unsigned intersectChildren(const WideNode<8, Bound>& node, const Tracer& ray, float tmax, float* tnear) {
+	__m256 tmin = _mm256_setzero_ps();
+	__m256 tfar = _mm256_set1_ps(tmax);
+
+	for (int axis=0; axis<3; ++axis) {
+		__m256 orig = _mm256_set1_ps(ray.orig[axis]);
+		__m256 invDir = _mm256_set1_ps(ray.invDir[axis]);
+
+		tmin = _mm256_max_ps(tmin, _mm256_mul_ps(_mm256_sub_ps(loadPlane(node, 2 * axis + ray.sign[axis]), orig), invDir));
+		tfar = _mm256_min_ps(tfar, _mm256_mul_ps(_mm256_sub_ps(loadPlane(node, 2 * axis + 1 - ray.sign[axis]), orig), invDir));
+	}
+
+	_mm256_storeu_ps(tnear, tmin);
+	return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(tmin, tfar, _CMP_LE_OQ)));
+}
+#endif
+
+// closest hit among the lanes of a packet, with exactly the tests of Tracer::intersectTriangle
+template<int Width>
+bool intersectPacket(const TrianglePacket<Width>& packet, const Tracer& ray, HitInfo& hitInfo) {
+	float closest = hitInfo.t;
+
+	for (int lane=0; lane<Width; ++lane) {
+		TriangleRecord record;
+		for (int axis=0; axis<3; ++axis) {
+			record.v0[axis] = packet.v0[axis][lane];
+			record.e1[axis] = packet.e1[axis][lane];
+			record.e2[axis] = packet.e2[axis][lane];
+		}
+
+		ray.intersectTriangle(record, packet.reference[lane], hitInfo);
+	}
+
+	return hitInfo.t < closest;
+}
+
+#ifdef KERNEL_SSE2
+template<>
+bool intersectPacket<4>(const TrianglePacket<4>& packet, const Tracer& ray, HitInfo& hitInfo) {
+	__m128 dir[3], tvec[3], e1[3], e2[3];
+	for (int axis=0; axis<3; ++axis) {
+		dir[axis] = _mm_set1_ps(ray.dir[axis]);
+		tvec[axis] = _mm_sub_ps(_mm_set1_ps(ray.orig[axis]), _mm_load_ps(packet.v0[axis]));
+		e1[axis] = _mm_load_ps(packet.e1[axis]);
+		e2[axis] = _mm_load_ps(packet.e2[axis]);
+	}
+
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dir[1], e2[2]), _mm_mul_ps(dir[2], e2[1]));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dir[2], e2[0]), _mm_mul_ps(dir[0], e2[2]));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dir[0], e2[1]), _mm_mul_ps(dir[1], e2[0]));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvec[0], px), _mm_mul_ps(tvec[1], py)), _mm_mul_ps(tvec[2], pz)), invDet);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(tvec[1], e1[2]), _mm_mul_ps(tvec[2], e1[1]));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tvec[2], e1[0]), _mm_mul_ps(tvec[0], e1[2]));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tvec[0], e1[1]), _mm_mul_ps(tvec[1], e1[0]));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dir[0], qx), _mm_mul_ps(dir[1], qy)), _mm_mul_ps(dir[2], qz)), invDet);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), invDet);
+
+	// negated comparisons, so that NaN lanes pass them just like in the scalar version
+	__m128 hit = _mm_and_ps(_mm_cmpngt_ps(det, _mm_setzero_ps()), _mm_cmpnlt_ps(u, _mm_setzero_ps()));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpngt_ps(u, _mm_set1_ps(1)), _mm_cmpnlt_ps(v, _mm_setzero_ps())));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpngt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.001f)), _mm_cmplt_ps(t, _mm_set1_ps(hitInfo.t))));
+
+	int mask = _mm_movemask_ps(hit);
+	if (!mask) return false;
+
+	// the first lane holding the smallest distance, as a sequential loop would keep
+	__m128 tmin = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+	tmin = _mm_min_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	tmin = _mm_min_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+	int lane = __builtin_ctz(mask & _mm_movemask_ps(_mm_cmpeq_ps(t, tmin)));
+
+	alignas(16) float us[4], vs[4], ts[4];
+	_mm_store_ps(us, u);
+	_mm_store_ps(vs, v);
+	_mm_store_ps(ts, t);
+
+	hitInfo.t = ts[lane];
+	hitInfo.u = us[lane];
+	hitInfo.v = vs[lane];
+	hitInfo.reference = packet.reference[lane];
+
+	return true;
+}
+#endif
+
+#ifdef KERNEL_AVX
+template<>
+bool intersectPacket<8>(const TrianglePacket<8>& packet, const Tracer& ray, HitInfo& hitInfo) {
+	__m256 dir[3], tvec[3], e1[3], e2[3];
+	for (int axis=0; axis<3; ++axis) {
+		dir[axis] = _mm256_set1_ps(ray.dir[axis]);
+		tvec[axis] = _mm256_sub_ps(_mm256_set1_ps(ray.orig[axis]), _mm256_load_ps(packet.v0[axis]));
+		e1[axis] = _mm256_load_ps(packet.e1[axis]);
+		e2[axis] = _mm256_load_ps(packet.e2[axis]);
+	}
+
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dir[1], e2[2]), _mm256_mul_ps(dir[2], e2[1]));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dir[2], e2[0]), _mm256_mul_ps(dir[0], e2[2]));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dir[0], e2[1]), _mm256_mul_ps(dir[1], e2[0]));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], px), _mm256_mul_ps(e1[1], py)), _mm256_mul_ps(e1[2], pz));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1), det);
+
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvec[0], px), _mm256_mul_ps(tvec[1], py)), _mm256_mul_ps(tvec[2], pz)), invDet);
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(tvec[1], e1[2]), _mm256_mul_ps(tvec[2], e1[1]));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tvec[2], e1[0]), _mm256_mul_ps(tvec[0], e1[2]));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tvec[0], e1[1]), _mm256_mul_ps(tvec[1], e1[0]));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dir[0], qx), _mm256_mul_ps(dir[1], qy)), _mm256_mul_ps(dir[2], qz)), invDet);
+	__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qx), _mm256_mul_ps(e2[1], qy)), _mm256_mul_ps(e2[2], qz)), invDet);
+
+	// negated comparisons, so that NaN lanes pass them just like in the scalar version
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(det, _mm256_setzero_ps(), _CMP_NGT_UQ), _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_NLT_UQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_set1_ps(1), _CMP_NGT_UQ), _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NLT_UQ)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.001f), _CMP_NGT_UQ), _mm256_cmp_ps(t, _mm256_set1_ps(hitInfo.t), _CMP_LT_OQ)));
+
+	int mask = _mm256_movemask_ps(hit);
+	if (!mask) return false;
+
+	// the first lane holding the smallest distance, as a sequential loop would keep
+	__m256 tmin = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), t, hit);
+	tmin = _mm256_min_ps(tmin, _mm256_permute2f128_ps(tmin, tmin, 1));
+	tmin = _mm256_min_ps(tmin, _mm256_shuffle_ps(tmin, tmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	tmin = _mm256_min_ps(tmin, _mm256_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+	int lane = __builtin_ctz(mask & _mm256_movemask_ps(_mm256_cmp_ps(t, tmin, _CMP_EQ_OQ)));
+
+	alignas(32) float us[8], vs[8], ts[8];
+	_mm256_store_ps(us, u);
+	_mm256_store_ps(vs, v);
+	_mm256_store_ps(ts, t);
+
+	hitInfo.t = ts[lane];
+	hitInfo.u = us[lane];
+	hitInfo.v = vs[lane];
+	hitInfo.reference = packet.reference[lane];
+
+	return true;
+}
+#endif
+
+// whether any lane is hit on either side between 0 and tmax
+template<int Width>
+bool occludedPacket(const TrianglePacket<Width>& packet, const Tracer& ray, float tmax) {
+	for (int lane=0; lane<Width; ++lane) {
+		TriangleRecord record;
+		for (int axis=0; axis<3; ++axis) {
+			record.v0[axis] = packet.v0[axis][lane];
+			record.e1[axis] = packet.e1[axis][lane];
+			record.e2[axis] = packet.e2[axis][lane];
+		}
+
+		if (ray.occludedBy(record, tmax)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#ifdef KERNEL_SSE2
+template<>
+bool occludedPacket<4>(const TrianglePacket<4>& packet, const Tracer& ray, float tmax) {
+	__m128 dir[3], tvec[3], e1[3], e2[3];
+	for (int axis=0; axis<3; ++axis) {
+		dir[axis] = _mm_set1_ps(ray.dir[axis]);
+		tvec[axis] = _mm_sub_ps(_mm_set1_ps(ray.orig[axis]), _mm_load_ps(packet.v0[axis]));
+		e1[axis] = _mm_load_ps(packet.e1[axis]);
+		e2[axis] = _mm_load_ps(packet.e2[axis]);
+	}
+
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dir[1], e2[2]), _mm_mul_ps(dir[2], e2[1]));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dir[2], e2[0]), _mm_mul_ps(dir[0], e2[2]));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dir[0], e2[1]), _mm_mul_ps(dir[1], e2[0]));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1), _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz)));
+
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvec[0], px), _mm_mul_ps(tvec[1], py)), _mm_mul_ps(tvec[2], pz)), invDet);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(tvec[1], e1[2]), _mm_mul_ps(tvec[2], e1[1]));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tvec[2], e1[0]), _mm_mul_ps(tvec[0], e1[2]));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tvec[0], e1[1]), _mm_mul_ps(tvec[1], e1[0]));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dir[0], qx), _mm_mul_ps(dir[1], qy)), _mm_mul_ps(dir[2], qz)), invDet);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), invDet);
+
+	// ordered comparisons, parallel and padding lanes are NaN or infinite and fail them
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.001f))));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, _mm_setzero_ps()), _mm_cmplt_ps(t, _mm_set1_ps(tmax))));
+
+	return _mm_movemask_ps(hit) != 0;
+}
+#endif
+
+#ifdef KERNEL_AVX
+template<>
+bool occludedPacket<8>(const TrianglePacket<8>& packet, const Tracer& ray, float tmax) {
+	__m256 dir[3], tvec[3], e1[3], e2[3];
+	for (int axis=0; axis<3; ++axis) {
+		dir[axis] = _mm256_set1_ps(ray.dir[axis]);
+		tvec[axis] = _mm256_sub_ps(_mm256_set1_ps(ray.orig[axis]), _mm256_load_ps(packet.v0[axis]));
+		e1[axis] = _mm256_load_ps(packet.e1[axis]);
+		e2[axis] = _mm256_load_ps(packet.e2[axis]);
+	}
+
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dir[1], e2[2]), _mm256_mul_ps(dir[2], e2[1]));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dir[2], e2[0]), _mm256_mul_ps(dir[0], e2[2]));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dir[0], e2[1]), _mm256_mul_ps(dir[1], e2[0]));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1), _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], px), _mm256_mul_ps(e1[1], py)), _mm256_mul_ps(e1[2], pz)));
+
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvec[0], px), _mm256_mul_ps(tvec[1], py)), _mm256_mul_ps(tvec[2], pz)), invDet);
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(tvec[1], e1[2]), _mm256_mul_ps(tvec[2], e1[1]));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tvec[2], e1[0]), _mm256_mul_ps(tvec[0], e1[2]));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tvec[0], e1[1]), _mm256_mul_ps(tvec[1], e1[0]));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dir[0], qx), _mm256_mul_ps(dir[1], qy)), _mm256_mul_ps(dir[2], qz)), invDet);
+	__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qx), _mm256_mul_ps(e2[1], qy)), _mm256_mul_ps(e2[2], qz)), invDet);
+
+	// ordered comparisons, parallel and padding lanes are NaN or infinite and fail them
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(u, _mm256_set1_ps(1), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.001f), _CMP_LE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ)));
+
+	return _mm256_movemask_ps(hit) != 0;
+}
+#endif
+
+template<int Width, typename Bound>
+bool occludedLeaf(const WideTree<Width, Bound>& tree, uint32_t offset, uint32_t count, const Tracer& ray, float tmax) {
+	for (uint32_t i=offset; i<offset + (count + Width - 1) / Width; ++i) {
+		if (occludedPacket(tree.packets[i], ray, tmax)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<int Width, typename Bound>
+bool intersectLeaf(const WideTree<Width, Bound>& tree, uint32_t offset, uint32_t count, const Tracer& ray, HitInfo& hitInfo) {
+	bool hit = false;
+
+	for (uint32_t i=offset; i<offset + (count + Width - 1) / Width; ++i) {
+		hit |= intersectPacket(tree.packets[i], ray, hitInfo);
+	}
+
+	return hit;
+}
+
+template<int Width, typename Bound>
+bool Tracer::occluded(const WideTree<Width, Bound>& tree, float tmax) const {
+	HitInfo hitInfo;
+	hitInfo.t = tmax;
+
+	return !tree.nodes.empty() && traverseWide<true>(tree, 0, hitInfo);
+}
+
+template<int Width, typename Bound>
+bool Tracer::intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo& hitInfo) const {
+	if (!tree.nodes.empty()) {
+		traverseWide<false>(tree, 0, hitInfo);
+	}
+
+	if (hitInfo) {
+		hitInfo.triangle = tree.triangle(hitInfo.reference);
+	}
+
+	return hitInfo;
+}
+
+template<bool AnyHit, int Width, typename Bound>
+bool Tracer::traverseWide(const WideTree<Width, Bound>& tree, uint32_t root, HitInfo& hitInfo) const {
+	WideEntry stack[stackSize];
+	int stackTop = 0;
+	uint32_t index = root;
+
+	while (true) {
+		const WideNode<Width, Bound>& node = tree.nodes[index];
+
+		float tnear[Width];
+		unsigned mask = intersectChildren(node, *this, hitInfo.t, tnear);
+
+		// children entered, farthest first unless any hit will do
+		WideEntry hits[Width];
+		int hitCount = 0;
+
+		for (; mask; mask &= mask - 1) {
+			int i = __builtin_ctz(mask);
+			WideEntry entry { node.offset[i], node.count[i], tnear[i] };
+
+			int j = hitCount++;
+			for (; !AnyHit && j > 0 && hits[j - 1].tnear < entry.tnear; --j) {
+				hits[j] = hits[j - 1];
+			}
+			hits[j] = entry;
+		}
+
+		for (int i=0; i<hitCount; ++i) {
+			// a full stack handles the entry right away instead
+			if (stackTop < stackSize) {
+				stack[stackTop++] = hits[i];
+			} else if (hits[i].count == 0) {
+				if (traverseWide<AnyHit>(tree, hits[i].offset, hitInfo) && AnyHit) {
+					return true;
+				}
+			} else if (AnyHit ? occludedLeaf(tree, hits[i].offset, hits[i].count, *this, hitInfo.t) : intersectLeaf(tree, hits[i].offset, hits[i].count, *this, hitInfo)) {
+				if (AnyHit) return true;
+			}
+		}
+
+		// leaves are intersected as they come off the stack, until the next interior node
+		while (true) {
+			if (stackTop == 0) {
+				return !AnyHit && hitInfo;
+			}
+
+			WideEntry entry = stack[--stackTop];
+
+			// nothing in a box entered beyond the closest hit can be closer
+			if (entry.tnear > hitInfo.t) {
+				continue;
+			}
+
+			if (entry.count == 0) {
+				index = entry.offset;
+				break;
+			}
+
+			if (AnyHit && occludedLeaf(tree, entry.offset, entry.count, *this, hitInfo.t)) {
+				return true;
+			} else if (!AnyHit) {
+				intersectLeaf(tree, entry.offset, entry.count, *this, hitInfo);
+			}
+		}
+	}
+}
+
+template<int Size>
+bool PacketTracer<Size>::intersectFlatTree(const FlatTree& tree, HitInfo* hitInfos) {
+	std::fill(packet.t, packet.t + Size, std::numeric_limits<float>::max());
+
+	if (!tree.nodes.empty()) {
+		traverse(tree, 0, allRays);
+	}
+
+	return collectHits(tree, hitInfos);
+}
+
+template<int Size>
+template<typename Tree>
+bool PacketTracer<Size>::collectHits(const Tree& tree, HitInfo* hitInfos) const {
+	bool hit = false;
+	for (int i=0; i<Size; ++i) {
+		hitInfos[i].t = packet.t[i];
+		hitInfos[i].u = packet.u[i];
+		hitInfos[i].v = packet.v[i];
+		hitInfos[i].reference = packet.reference[i];
+
+		if (hitInfos[i]) {
+			hitInfos[i].triangle = tree.triangle(packet.reference[i]);
+			hit = true;
+		}
+	}
+
+	return hit;
+}
+
+template<int Size>
+void PacketTracer<Size>::traverse(const FlatTree& tree, uint32_t root, uint64_t active) {
+	// children are only tested with the rays that entered their parent, pushed along with them
+	uint32_t stack[Ray::stackSize];
+	uint64_t stackActive[Ray::stackSize];
+	int stackTop = 0;
+	uint32_t index = root;
+
+	while (true) {
+		const FlatNode& node = tree.nodes[index];
+
+		if ((active = intersectBoundingBox(node.bbox, active))) {
+			if (node.isLeaf()) {
+				for (uint32_t i=node.offset; i<node.offset + node.count; ++i) {
+					intersectTriangle(tree.records[i], i, active);
+				}
+			} else {
+				// every ray agrees on which child is nearer
+				uint32_t nearChild = index + 1, farChild = node.offset;
+				if (sign[node.axis]) {
+					std::swap(nearChild, farChild);
+				}
+
+				if (stackTop == Ray::stackSize) {
+					traverse(tree, farChild, active);
+				} else {
+					stack[stackTop] = farChild;
+					stackActive[stackTop++] = active;
+				}
+
+				index = nearChild;
+				continue;
+			}
+		}
+
+		if (stackTop == 0) {
+			return;
+		}
+		--stackTop;
+		index = stack[stackTop];
+		active = stackActive[stackTop];
+	}
+}
+
+template<int Size>
+template<int Width, typename Bound>
+bool PacketTracer<Size>::intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo* hitInfos) {
+	std::fill(packet.t, packet.t + Size, std::numeric_limits<float>::max());
+
+	uint64_t active = tree.nodes.empty() ? 0 : intersectBoundingBox(tree.bbox, allRays);
+
+	if (active) {
+		boundDirections();
+		traverseWide(tree, PacketEntry { 0, 0, active, 0 });
+	}
+
+	return collectHits(tree, hitInfos);
+}
+
+template<int Size>
+template<int Width, typename Bound>
+void PacketTracer<Size>::traverseWide(const WideTree<Width, Bound>& tree, const PacketEntry& root) {
+	PacketEntry stack[Ray::stackSize];
+	int stackTop = 0;
+	PacketEntry entry = root;
+
+	while (true) {
+		const WideNode<Width, Bound>& node = tree.nodes[entry.offset];
+
+		// children entered by any ray, farthest first
+		PacketEntry hits[Width];
+		int hitCount = 0;
+
+		for (int i=0; i<Width; ++i) {
+			if (!mayEnter(node, i)) continue;
+
+			PacketEntry child { node.offset[i], node.count[i], 0, 0 };
+			child.active = intersectChild(node, i, entry.active, child.tnear);
+
+			if (!child.active) continue;
+
+			int j = hitCount++;
+			for (; j > 0 && hits[j - 1].tnear < child.tnear; --j) {
+				hits[j] = hits[j - 1];
+			}
+			hits[j] = child;
+		}
+
+		for (int i=0; i<hitCount; ++i) {
+			// a full stack handles the entry right away instead
+			if (stackTop < Ray::stackSize) {
+				stack[stackTop++] = hits[i];
+			} else if (hits[i].count == 0) {
+				traverseWide(tree, hits[i]);
+			} else {
+				intersectWideLeaf(tree, hits[i]);
+			}
+		}
+
+		// leaves are intersected as they come off the stack, until the next interior node
+		while (true) {
+			if (stackTop == 0) {
+				return;
+			}
+
+			entry = stack[--stackTop];
+			int rays = cull(entry);
+
+			if (rays == 0) {
+				continue;
+			}
+
+			if (rays <= aloneRays) {
+				traceAlone(tree, entry);
+			} else if (entry.count == 0) {
+				break;
+			} else {
+				intersectWideLeaf(tree, entry);
+			}
+		}
+	}
+}
+
+template<int Size>
+template<int Width, typename Bound>
+bool PacketTracer<Size>::mayEnter(const WideNode<Width, Bound>& node, int i) const {
+	if (!bounded) {
+		return true;
+	}
+
+	// every ray enters no earlier and leaves no later than the extreme products of its own planes
+	float tnear = 0, tfar = std::numeric_limits<float>::max();
+
+	for (int axis=0; axis<3; ++axis) {
+		float nearPlane = node.bound(2 * axis + sign[axis], i) - packet.orig[axis];
+		float farPlane = node.bound(2 * axis + 1 - sign[axis], i) - packet.orig[axis];
+
+		tnear = std::max(tnear, std::min(nearPlane * invMin[axis], nearPlane * invMax[axis]));
+		tfar = std::min(tfar, std::max(farPlane * invMin[axis], farPlane * invMax[axis]));
+	}
+
+	return tnear <= tfar;
+}
+
+template<int Size>
+template<int Width, typename Bound>
+void PacketTracer<Size>::intersectWideLeaf(const WideTree<Width, Bound>& tree, const PacketEntry& entry) {
+	for (uint32_t i=0; i<entry.count; ++i) {
+		const TrianglePacket<Width>& triangles = tree.packets[entry.offset + i / Width];
+		int lane = i % Width;
+
+		TriangleRecord record;
+		for (int axis=0; axis<3; ++axis) {
+			record.v0[axis] = triangles.v0[axis][lane];
+			record.e1[axis] = triangles.e1[axis][lane];
+			record.e2[axis] = triangles.e2[axis][lane];
+		}
+
+		intersectTriangle(record, triangles.reference[lane], entry.active);
+	}
+}
+
+template<int Size>
+template<int Width, typename Bound>
+void PacketTracer<Size>::traceAlone(const WideTree<Width, Bound>& tree, const PacketEntry& entry) {
+	for (uint64_t bits = entry.active; bits; bits &= bits - 1) {
+		int i = __builtin_ctzll(bits);
+		Tracer ray(Ray(packet.orig, glm::vec3{ packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] }));
+
+		HitInfo hitInfo;
+		hitInfo.t = packet.t[i];
+
+		if (entry.count == 0) {
+			ray.traverseWide<false>(tree, entry.offset, hitInfo);
+		} else {
+			intersectLeaf(tree, entry.offset, entry.count, ray, hitInfo);
+		}
+
+		if (hitInfo.t < packet.t[i]) {
+			packet.t[i] = hitInfo.t;
+			packet.u[i] = hitInfo.u;
+			packet.v[i] = hitInfo.v;
+			packet.reference[i] = hitInfo.reference;
+		}
+	}
+}
+
+#ifdef KERNEL_SSE2
+template<int Size>
+uint64_t PacketTracer<Size>::intersectBoundingBox(const BoundingBox& bbox, uint64_t active) const {
+	const glm::vec3* bounds = &bbox.min;
+	uint64_t entered = 0;
+
+	// the planes are the same for every ray, only the reciprocal directions differ
+	__m128 nearX = _mm_set1_ps(bounds[sign[0]].x - packet.orig.x), farX = _mm_set1_ps(bounds[1 - sign[0]].x - packet.orig.x);
+	__m128 nearY = _mm_set1_ps(bounds[sign[1]].y - packet.orig.y), farY = _mm_set1_ps(bounds[1 - sign[1]].y - packet.orig.y);
+	__m128 nearZ = _mm_set1_ps(bounds[sign[2]].z - packet.orig.z), farZ = _mm_set1_ps(bounds[1 - sign[2]].z - packet.orig.z);
+
+	for (int i=0; i<Size; i+=4) {
+		unsigned group = static_cast<unsigned>(active >> i) & 0xF;
+		if (!group) continue;
+
+		__m128 invX = _mm_load_ps(packet.invDir[0] + i), invY = _mm_load_ps(packet.invDir[1] + i), invZ = _mm_load_ps(packet.invDir[2] + i);
+
+		__m128 tnear = _mm_max_ps(_mm_max_ps(_mm_mul_ps(nearX, invX), _mm_mul_ps(nearY, invY)), _mm_max_ps(_mm_mul_ps(nearZ, invZ), _mm_setzero_ps()));
+		__m128 tfar = _mm_min_ps(_mm_min_ps(_mm_mul_ps(farX, invX), _mm_mul_ps(farY, invY)), _mm_min_ps(_mm_mul_ps(farZ, invZ), _mm_load_ps(packet.t + i)));
+
+		entered |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tnear, tfar))) & group) << i;
+	}
+
+	return entered;
+}
+
+template<int Size>
+template<int Width, typename Bound>
+uint64_t PacketTracer<Size>::intersectChild(const WideNode<Width, Bound>& node, int child, uint64_t active, float& tnear) const {
+	__m128 nearX = _mm_set1_ps(node.bound(sign[0], child) - packet.orig.x), farX = _mm_set1_ps(node.bound(1 - sign[0], child) - packet.orig.x);
+	__m128 nearY = _mm_set1_ps(node.bound(2 + sign[1], child) - packet.orig.y), farY = _mm_set1_ps(node.bound(3 - sign[1], child) - packet.orig.y);
+	__m128 nearZ = _mm_set1_ps(node.bound(4 + sign[2], child) - packet.orig.z), farZ = _mm_set1_ps(node.bound(5 - sign[2], child) - packet.orig.z);
+
+	uint64_t entered = 0;
+	__m128 closest = _mm_set1_ps(std::numeric_limits<float>::max());
+	__m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+
+	for (int i=0; i<Size; i+=4) {
+		unsigned group = static_cast<unsigned>(active >> i) & 0xF;
+		if (!group) continue;
+
+		__m128 invX = _mm_load_ps(packet.invDir[0] + i), invY = _mm_load_ps(packet.invDir[1] + i), invZ = _mm_load_ps(packet.invDir[2] + i);
+
+		__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_mul_ps(nearX, invX), _mm_mul_ps(nearY, invY)), _mm_max_ps(_mm_mul_ps(nearZ, invZ), _mm_setzero_ps()));
+		__m128 tmax = _mm_min_ps(_mm_min_ps(_mm_mul_ps(farX, invX), _mm_mul_ps(farY, invY)), _mm_min_ps(_mm_mul_ps(farZ, invZ), _mm_load_ps(packet.t + i)));
+
+		// only rays that were active and entered the box count
+		__m128 inside = _mm_and_ps(_mm_cmple_ps(tmin, tmax), _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(group)), lanes), lanes)));
+
+		entered |= static_cast<uint64_t>(_mm_movemask_ps(inside)) << i;
+		closest = _mm_min_ps(closest, _mm_or_ps(_mm_and_ps(inside, tmin), _mm_andnot_ps(inside, closest)));
+	}
+
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+	tnear = _mm_cvtss_f32(closest);
+
+	return entered;
+}
+
+template<int Size>
+int PacketTracer<Size>::cull(PacketEntry& entry) const {
+	__m128 tnear = _mm_set1_ps(entry.tnear);
+	uint64_t left = 0;
+	int rays = 0;
+
+	for (int i=0; i<Size; i+=4) {
+		unsigned group = static_cast<unsigned>(entry.active >> i) & 0xF;
+		if (!group) continue;
+
+		unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_cmpnlt_ps(_mm_load_ps(packet.t + i), tnear))) & group;
+		left |= static_cast<uint64_t>(mask) << i;
+		rays += groupRays[mask];
+	}
+
+	entry.active = left;
+	return rays;
+}
+
+template<int Size>
+void PacketTracer<Size>::boundDirections() {
+	bounded = true;
+
+	for (int axis=0; axis<3; ++axis) {
+		__m128 lo = _mm_load_ps(packet.invDir[axis]), hi = lo;
+
+		for (int i=4; i<Size; i+=4) {
+			lo = _mm_min_ps(lo, _mm_load_ps(packet.invDir[axis] + i));
+			hi = _mm_max_ps(hi, _mm_load_ps(packet.invDir[axis] + i));
+		}
+
+		lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+		lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+		hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+		hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		invMin[axis] = _mm_cvtss_f32(lo);
+		invMax[axis] = _mm_cvtss_f32(hi);
+		bounded &= std::isfinite(invMin[axis]) && std::isfinite(invMax[axis]);
+	}
+}
+
+template<int Size>
+void PacketTracer<Size>::intersectTriangle(const TriangleRecord& triangle, uint32_t ref, uint64_t active) {
+	// with a shared origin everything but pvec is the same for every ray
+	glm::vec3 tvec = packet.orig - triangle.v0;
+	glm::vec3 qvec = glm::cross(tvec, triangle.e1);
+	__m128 tq = _mm_set1_ps(glm::dot(triangle.e2, qvec));
+
+	for (int i=0; i<Size; i+=4) {
+		unsigned group = static_cast<unsigned>(active >> i) & 0xF;
+		if (!group) continue;
+
+		__m128 dx = _mm_load_ps(packet.dir[0] + i), dy = _mm_load_ps(packet.dir[1] + i), dz = _mm_load_ps(packet.dir[2] + i);
+
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, _mm_set1_ps(triangle.e2.z)), _mm_mul_ps(dz, _mm_set1_ps(triangle.e2.y)));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, _mm_set1_ps(triangle.e2.x)), _mm_mul_ps(dx, _mm_set1_ps(triangle.e2.z)));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, _mm_set1_ps(triangle.e2.y)), _mm_mul_ps(dy, _mm_set1_ps(triangle.e2.x)));
+
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.e1.x), px), _mm_mul_ps(_mm_set1_ps(triangle.e1.y), py)), _mm_mul_ps(_mm_set1_ps(triangle.e1.z), pz));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+
+		__m128 pu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tvec.x), px), _mm_mul_ps(_mm_set1_ps(tvec.y), py)), _mm_mul_ps(_mm_set1_ps(tvec.z), pz));
+		__m128 pv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(qvec.x)), _mm_mul_ps(dy, _mm_set1_ps(qvec.y))), _mm_mul_ps(dz, _mm_set1_ps(qvec.z)));
+		__m128 hu = _mm_mul_ps(pu, invDet);
+		__m128 hv = _mm_mul_ps(pv, invDet);
+		__m128 ht = _mm_mul_ps(tq, invDet);
+
+		// the tests of Ray::intersectTriangle, negated so that NaN lanes pass them the same way
+		__m128 hit = _mm_and_ps(_mm_cmpngt_ps(det, _mm_setzero_ps()), _mm_cmpnlt_ps(hu, _mm_setzero_ps()));
+		hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpngt_ps(hu, _mm_set1_ps(1)), _mm_cmpnlt_ps(hv, _mm_setzero_ps())));
+		hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpngt_ps(_mm_add_ps(hu, hv), _mm_set1_ps(1.001f)), _mm_cmplt_ps(ht, _mm_load_ps(packet.t + i))));
+
+		unsigned mask = static_cast<unsigned>(_mm_movemask_ps(hit)) & group;
+		if (!mask) continue;
+
+		alignas(16) float ts[4], us[4], vs[4];
+		_mm_store_ps(ts, ht);
+		_mm_store_ps(us, hu);
+		_mm_store_ps(vs, hv);
+
+		for (; mask; mask &= mask - 1) {
+			int lane = __builtin_ctz(mask);
+
+			packet.t[i + lane] = ts[lane];
+			packet.u[i + lane] = us[lane];
+			packet.v[i + lane] = vs[lane];
+			packet.reference[i + lane] = ref;
+		}
+	}
+}
+#else
+template<int Size>
+uint64_t PacketTracer<Size>::intersectBoundingBox(const BoundingBox& bbox, uint64_t active) const {
+	uint64_t entered = 0;
+
+	for (uint64_t bits = active; bits; bits &= bits - 1) {
+		int i = __builtin_ctzll(bits);
+		Tracer ray(Ray(packet.orig, glm::vec3{ packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] }));
+
+		float tnear, tfar;
+		if (ray.intersectBoundingBox(bbox, packet.t[i], tnear, tfar)) {
+			entered |= uint64_t(1) << i;
+		}
+	}
+
+	return entered;
+}
+
+template<int Size>
+template<int Width, typename Bound>
+uint64_t PacketTracer<Size>::intersectChild(const WideNode<Width, Bound>& node, int child, uint64_t active, float& tnear) const {
+	uint64_t entered = 0;
+	tnear = std::numeric_limits<float>::max();
+
+	for (uint64_t bits = active; bits; bits &= bits - 1) {
+		int i = __builtin_ctzll(bits);
+		float tmin = 0, tmax = packet.t[i];
+
+		for (int axis=0; axis<3; ++axis) {
+			tmin = std::max(tmin, (node.bound(2 * axis + sign[axis], child) - packet.orig[axis]) * packet.invDir[axis][i]);
+			tmax = std::min(tmax, (node.bound(2 * axis + 1 - sign[axis], child) - packet.orig[axis]) * packet.invDir[axis][i]);
+		}
+
+		if (tmin <= tmax) {
+			entered |= uint64_t(1) << i;
+			tnear = std::min(tnear, tmin);
+		}
+	}
+
+	return entered;
+}
+
+template<int Size>
+int PacketTracer<Size>::cull(PacketEntry& entry) const {
+	int rays = 0;
+
+	for (uint64_t bits = entry.active; bits; bits &= bits - 1) {
+		int i = __builtin_ctzll(bits);
+
+		if (packet.t[i] < entry.tnear) {
+			entry.active &= ~(uint64_t(1) << i);
+		} else {
+			rays++;
+		}
+	}
+
+	return rays;
+}
+
+template<int Size>
+void PacketTracer<Size>::boundDirections() {
+	bounded = true;
+
+	for (int axis=0; axis<3; ++axis) {
+		invMin[axis] = *std::min_element(packet.invDir[axis], packet.invDir[axis] + Size);
+		invMax[axis] = *std::max_element(packet.invDir[axis], packet.invDir[axis] + Size);
+		bounded &= std::isfinite(invMin[axis]) && std::isfinite(invMax[axis]);
+	}
+}
+
+template<int Size>
+void PacketTracer<Size>::intersectTriangle(const TriangleRecord& triangle, uint32_t ref, uint64_t active) {
+	for (uint64_t bits = active; bits; bits &= bits - 1) {
+		int i = __builtin_ctzll(bits);
+		Tracer ray(Ray(packet.orig, glm::vec3{ packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] }));
+
+		HitInfo hitInfo;
+		hitInfo.t = packet.t[i];
+
+		if (ray.intersectTriangle(triangle, ref, hitInfo) && hitInfo.t < packet.t[i]) {
+			packet.t[i] = hitInfo.t;
+			packet.u[i] = hitInfo.u;
+			packet.v[i] = hitInfo.v;
+			packet.reference[i] = ref;
+		}
+	}
+}
+#endif
+
+bool intersectFlatTree(const Ray& ray, const FlatTree& tree, HitInfo& hitInfo) {
+	return Tracer(ray).intersectFlatTree(tree, hitInfo);
+}
+
+bool occludedFlatTree(const Ray& ray, const FlatTree& tree, float tmax) {
+	return Tracer(ray).occluded(tree, tmax);
+}
+
+template<int Width, typename Bound>
+bool intersectWideTree(const Ray& ray, const WideTree<Width, Bound>& tree, HitInfo& hitInfo) {
+	return Tracer(ray).intersectWideTree(tree, hitInfo);
+}
+
+template<int Width, typename Bound>
+bool occludedWideTree(const Ray& ray, const WideTree<Width, Bound>& tree, float tmax) {
+	return Tracer(ray).occluded(tree, tmax);
+}
+
+template<int Size>
+bool intersectRayPacket(RayPacket<Size>& packet, const FlatTree& tree, HitInfo* hitInfos) {
+	return PacketTracer<Size>(packet).intersectFlatTree(tree, hitInfos);
+}
+
+template<int Size, int Width, typename Bound>
+bool intersectWidePacket(RayPacket<Size>& packet, const WideTree<Width, Bound>& tree, HitInfo* hitInfos) {
+	return PacketTracer<Size>(packet).intersectWideTree(tree, hitInfos);
+}
+
+}
+
+const Kernels KERNEL_TABLE {
+	KERNEL_NAME,
+	KERNEL_SUPPORTED,
+	{ intersectFlatTree, occludedFlatTree, intersectRayPacket<4>, intersectRayPacket<16>, intersectRayPacket<64> },
+	{
+		intersectWideTree<4, float>, occludedWideTree<4, float>,
+		intersectWidePacket<4, 4, float>, intersectWidePacket<16, 4, float>, intersectWidePacket<64, 4, float>
+	},
+	{
+		intersectWideTree<8, float>, occludedWideTree<8, float>,
+		intersectWidePacket<4, 8, float>, intersectWidePacket<16, 8, float>, intersectWidePacket<64, 8, float>
+	},
+	{
+		intersectWideTree<4, uint8_t>, occludedWideTree<4, uint8_t>,
+		intersectWidePacket<4, 4, uint8_t>, intersectWidePacket<16, 4, uint8_t>, intersectWidePacket<64, 4, uint8_t>
+	},
+	{
+		intersectWideTree<4, uint16_t>, occludedWideTree<4, uint16_t>,
+		intersectWidePacket<4, 4, uint16_t>, intersectWidePacket<16, 4, uint16_t>, intersectWidePacket<64, 4, uint16_t>
+	},
+	{
+		intersectWideTree<8, uint8_t>, occludedWideTree<8, uint8_t>,
+		intersectWidePacket<4, 8, uint8_t>, intersectWidePacket<16, 8, uint8_t>, intersectWidePacket<64, 8, uint8_t>
+	},
+	{
+		intersectWideTree<8, uint16_t>, occludedWideTree<8, uint16_t>,
+		intersectWidePacket<4, 8, uint16_t>, intersectWidePacket<16, 8, uint16_t>, intersectWidePacket<64, 8, uint16_t>
+	}
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "flattree.h"
+#include "widetree.h"
+#include "hitinfo.h"
+
+// rays of a square block of pixels sharing their origin, traced through a tree together.
+// Size is the number of rays, only 4, 16 and 64 exist
+template<int Size>
+struct RayPacket {
+	glm::vec3 orig;
+	alignas(16) float dir[3][Size];
+	alignas(16) float invDir[3][Size];
+
+	// closest hit of every ray so far
+	alignas(16) float t[Size];
+	alignas(16) float u[Size];
+	alignas(16) float v[Size];
+	alignas(16) uint32_t reference[Size];
+
+	static constexpr int size = Size;
+
+	void setRay(int i, const glm::vec3& rayDir);
+
+	// whether every ray points into the same octant, only then can they share traversal decisions
+	bool coherent() const;
+
+	// traced by the active kernels
+	bool intersectFlatTree(const FlatTree& tree, HitInfo* hitInfos);
+
+	template<int Width, typename Bound>
+	bool intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo* hitInfos);
+};
@@ -24,8 +24,19 @@
 #include "hitinfo.h"
 #include "vertex.h"
 #include "kdnode.h"
+#include "bvhnode.h"
+#include "flattree.h"
+#include "widetree.h"
+#include "treelet.h"
+#include "treecache.h"
+#include "buildparams.h"
+#include "parallel.h"
+#include "progress.h"
+#include "workqueue.h"
+#include "renderparams.h"
 #include "light.h"
 #include "ray.h"
+#include "raypacket.h"
 
 class Renderer {
 private:
@@ -54,26 +65,80 @@ private:
 
 	constexpr static float epsilon = 1e-8f;
 
-	std::atomic_size_t drawingIndex;
+	std::atomic_bool stopRendering { false };
 
-	std::unique_ptr<KdNode> kdTree;
+	FlatTree tree;
+	WideTree<4> tree4;
+	WideTree<8> tree8;
+	WideTree<4, uint8_t> tree4x8;
+	WideTree<4, uint16_t> tree4x16;
+	WideTree<8, uint8_t> tree8x8;
+	WideTree<8, uint16_t> tree8x16;
+	bool treeBuilt = false;
+	float treeBuildCost = 0;
+	BuildParams treeBuildParams;
+
+	std::string modelName;
+	std::string sceneModelName;
+	bool modelChanged = false;
+
+	std::string cacheDirectory;
+	std::string cacheFileName;
+	uint64_t cacheKey = 0;
+	TreeCache::WideSection cachedWideTree;
+
+	BuildParams defaultBuildParams;
+	BuildParams buildParams;
+
+	RenderParams defaultRenderParams;
+	RenderParams renderParams;
+
+	// tiles in the order they are handed out
+	std::vector<uint32_t> tileSequence;
+
+	bool occlusionBenchmark = false;
+
+	Progress::Mode progressMode = Progress::Mode::Bar;
+	std::chrono::milliseconds progressInterval { 250 };
 
 	unsigned threadCount = 1;
-	std::mutex coutMutex;
-	std::vector<std::thread> workers;
+	// images still being encoded
+	TaskGroup imageWrites;
 
 	void loadModel(const std::string& modelName);
 	void loadScene(const std::string& sceneFileName);
-	void applyTransformation();
+	void loadSceneModel();
+	bool loadCachedTree();
+	void applyTransformation(bool transformVertices);
 	void buildKdTree();
+	bool refitKdTree();
+	template<typename Node>
+	void optimizeTree(Node& root);
+	void collapseTree();
+	template<typename Function>
+	bool visitWideTree(Function function);
+	bool traceRay(const Ray& ray, HitInfo& hitInfo);
+	bool occluded(const Ray& ray, float tmax);
+	void benchmarkOcclusion();
+	uint32_t shadePixel(const glm::vec3& dir, const HitInfo& hitInfo);
 	uint32_t calculatePixel(uint32_t x, uint32_t y);
+	template<int Side>
+	void calculatePacket(uint32_t x0, uint32_t y0, uint32_t* pixels, size_t stride);
+	size_t calculateStrip(size_t tileIndex, uint32_t strip, std::vector<uint32_t>& pixels);
+	size_t tileCount();
+	void orderTiles();
 
-	void workerFunction();
-	void spawnWorkers();
-	void joinWorkers();
+	void workerFunction(WorkQueue& queue, Progress& progress, unsigned slot);
+	void writeImage(const std::string& sceneName);
 
 public:
 	void run(const std::string& sceneName);
 	void killThreads();
+	void waitForImages();
 	void setThreadCount(unsigned threadCount);
+	void setBuildParams(const BuildParams& buildParams);
+	void setRenderParams(const RenderParams& renderParams);
+	void setOcclusionBenchmark(bool occlusionBenchmark);
+	void setCacheDirectory(const std::string& cacheDirectory);
+	void setProgress(Progress::Mode progressMode, std::chrono::milliseconds progressInterval);
 };
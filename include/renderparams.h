@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+struct RenderParams {
+	enum class TileOrder { Scanline, Morton, Hilbert };
+
+	// primary rays are traced in packets of packetSize x packetSize pixels, 1 traces every ray alone
+	int packetSize = 8;
+
+	// threads claim the image one tile at a time and render it into a buffer of their own. Tiles
+	// are rounded up to whole packets
+	uint32_t tileWidth = 16;
+	uint32_t tileHeight = 16;
+
+	// the order tiles are handed out in. Along a space filling curve the tiles a thread renders one
+	// after another lie close together and find more of the tree still in its caches
+	TileOrder tileOrder = TileOrder::Hilbert;
+
+	// "W" or "WxH"
+	inline void parseTileSize(const std::string& size) {
+		size_t x = size.find('x');
+		int w = std::stoi(size.substr(0, x));
+		int h = x == std::string::npos ? w : std::stoi(size.substr(x + 1));
+
+		if (w <= 0 || h <= 0) {
+			throw std::runtime_error("tile size must be positive!");
+		}
+
+		tileWidth = static_cast<uint32_t>(w);
+		tileHeight = static_cast<uint32_t>(h);
+	}
+
+	inline static TileOrder parseTileOrder(const std::string& name) {
+		if (name == "scanline") return TileOrder::Scanline;
+		if (name == "morton") return TileOrder::Morton;
+		if (name == "hilbert") return TileOrder::Hilbert;
+
+		throw std::runtime_error("unknown tile order '" + name + "'!");
+	}
+
+	inline static const char* tileOrderName(TileOrder tileOrder) {
+		switch (tileOrder) {
+			case TileOrder::Scanline: return "scanline";
+			case TileOrder::Morton: return "morton";
+			case TileOrder::Hilbert: return "hilbert";
+		}
+
+		return "unknown";
+	}
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// the tasks of one parallel section, waited on together
+class TaskGroup {
+	friend class ThreadPool;
+
+	std::atomic_size_t pending { 0 };
+
+	// the first exception a task threw, rethrown by wait
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+// a fixed set of threads, each with a deque of its own. Workers take their newest task first and
+// steal the oldest one of another worker when they run out, then sleep until something is queued.
+// Threads outside the pool share the first deque
+class ThreadPool {
+public:
+	// threadCount includes the thread that waits on the pool, which runs tasks while it waits
+	explicit ThreadPool(unsigned threadCount);
+
+	// runs whatever is still queued before joining
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	inline unsigned threadCount() const {
+		return static_cast<unsigned>(workers.size());
+	}
+
+	void submit(TaskGroup& group, std::function<void()> task);
+
+	// runs queued tasks, of any group, until every task of group is done
+	void wait(TaskGroup& group);
+
+	// the pool parallelFor and parallelInvoke run on, created in main. Without one they run serially
+	static ThreadPool* global;
+
+private:
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	// idle threads sleep on wakeUp until a task is queued or a group they wait on is done
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic_size_t queued { 0 };
+	bool stopping = false;
+
+	// the deque of the calling thread
+	unsigned self() const;
+
+	bool runTask(unsigned index);
+	void notify();
+	void workerLoop(unsigned index);
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "buildparams.h"
+#include "flattree.h"
+#include "widetree.h"
+
+// private, writable mapping of a whole file, writes never reach the file
+struct MappedFile {
+	void* data;
+	size_t size;
+
+	explicit MappedFile(const std::string& fileName);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// built trees saved together with the transformed vertices they reference, laid out exactly
+// as FlatTree reads them so that loading is just mapping the file
+struct TreeCache {
+	static uint64_t hashFile(const std::string& fileName);
+	static uint64_t key(uint64_t modelHash, const glm::mat4& transformation, const BuildParams& params);
+
+	// creates directory if needed, throws unless it ends up a writable directory
+	static void prepareDirectory(const std::string& directory);
+
+	// the wide tree collapsed from the saved one, of whichever width and node bits it was
+	// rendered with. Other widths collapse the binary tree again
+	struct WideSection {
+		uint32_t width = 0; // 0 when there is none
+		uint32_t nodeBits = 0;
+		uint32_t nodeSize = 0;
+		uint32_t packetSize = 0;
+		void* nodes = nullptr;
+		uint64_t nodeCount = 0;
+		void* packets = nullptr;
+		uint64_t packetCount = 0;
+	};
+
+	static bool load(const std::string& fileName, uint64_t key, FlatTree& tree, WideSection& wide, float& buildCost);
+	static void save(const std::string& fileName, uint64_t key, const FlatTree& tree, const WideSection& wide, float buildCost);
+
+	template<int Width, typename Bound>
+	static WideSection section(const WideTree<Width, Bound>& wide) {
+		return {
+			Width, WideTree<Width, Bound>::nodeBits, sizeof(WideNode<Width, Bound>), sizeof(TrianglePacket<Width>),
+			wide.nodes.data(), wide.nodes.size(), wide.packets.data(), wide.packets.size()
+		};
+	}
+
+	// points wide at the section loaded together with tree, false if it holds another kind of tree
+	// or one whose children and triangles do not all lie within the mapped sections
+	template<int Width, typename Bound>
+	static bool map(const WideSection& section, const FlatTree& tree, WideTree<Width, Bound>& wide) {
+		if (section.width != Width || section.nodeBits != WideTree<Width, Bound>::nodeBits || section.nodeSize != sizeof(WideNode<Width, Bound>)
+			|| section.packetSize != sizeof(TrianglePacket<Width>) || !tree.mapping) {
+			return false;
+		}
+
+		wide = WideTree<Width, Bound>();
+		wide.nodes = { static_cast<WideNode<Width, Bound>*>(section.nodes), section.nodeCount };
+		wide.packets = { static_cast<TrianglePacket<Width>*>(section.packets), section.packetCount };
+		wide.triangles = tree.triangles;
+		wide.vertices = tree.vertices;
+		wide.mapping = tree.mapping;
+
+		if (!tree.nodes.empty()) {
+			wide.bbox = tree.nodes[0].bbox;
+		}
+
+		if (!isValid(wide) || wide.nodes.empty() != tree.nodes.empty()) {
+			wide = WideTree<Width, Bound>();
+			return false;
+		}
+
+		return true;
+	}
+
+	// the section sizes alone say nothing about the indices inside them. Children always come after their
+	// parent and everything points within its section, so that a corrupted or foreign file that got this
+	// far can neither make traversal read outside the mapping nor loop
+	static bool isValid(const FlatTree& tree);
+
+	template<int Width, typename Bound>
+	static bool isValid(const WideTree<Width, Bound>& wide) {
+		for (size_t i=0; i<wide.nodes.size(); ++i) {
+			const WideNode<Width, Bound>& node = wide.nodes[i];
+
+			for (int j=0; j<Width; ++j) {
+				uint64_t offset = node.offset[j];
+
+				if (node.count[j] > 0) {
+					if (offset + (node.count[j] + Width - 1) / Width > wide.packets.size()) {
+						return false;
+					}
+				} else if ((offset <= i || offset >= wide.nodes.size()) && !(node.bound(0, j) > node.bound(1, j))) {
+					// only empty slots, whose inverted bounds are never entered, may point anywhere else
+					return false;
+				}
+			}
+		}
+
+		for (const TrianglePacket<Width>& packet : wide.packets) {
+			for (int lane=0; lane<Width; ++lane) {
+				if (packet.reference[lane] >= wide.triangles.size()) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+};
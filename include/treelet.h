@@ -0,0 +1,12 @@
+#pragma once
+
+#include "buildparams.h"
+
+// SAH cost of the subtree below node, normalized by the node surface area
+template<typename Node>
+float sahCost(const Node& node, const BuildParams& params);
+
+// restructures treelets of up to 7 leaves into their SAH optimal topology, params.treeletPasses times,
+// and returns the normalized SAH cost of the resulting tree
+template<typename Node>
+float optimizeTreelets(Node& root, const BuildParams& params);
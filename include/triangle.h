@@ -3,7 +3,18 @@
 #include "vertex.h"
 
 struct Triangle {
-	Vertex* v0;
-	Vertex* v1;
-	Vertex* v2;
+	const Vertex* v0;
+	const Vertex* v1;
+	const Vertex* v2;
+};
+
+// what intersection needs of a triangle, stored contiguously in leaf order
+struct TriangleRecord {
+	glm::vec3 v0;
+	glm::vec3 e1; // v1 - v0
+	glm::vec3 e2; // v2 - v0
+
+	inline static TriangleRecord fromTriangle(const Triangle& triangle) {
+		return { triangle.v0->pos, triangle.v1->pos - triangle.v0->pos, triangle.v2->pos - triangle.v0->pos };
+	}
 };
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "alignedallocator.h"
+#include "arrayview.h"
+#include "flattree.h"
+
+// children bounds in SoA layout so that one ray tests all of them at once. Bound is float for
+// full precision bounds, uint8_t or uint16_t for bounds quantized relative to the node
+template<int Width, typename Bound = float>
+struct WideNode;
+
+template<int Width>
+struct alignas(64) WideNode<Width, float> {
+	float bounds[6][Width]; // min x, max x, min y, max y, min z, max z of every child
+	uint32_t offset[Width]; // child node for interior children, first triangle for leaves
+	uint16_t count[Width]; // triangles of leaf children, 0 for interior children and empty slots
+
+	static constexpr int width = Width;
+
+	inline float bound(int plane, int i) const {
+		return bounds[plane][i];
+	}
+
+	// empty slots past count get inverted bounds
+	void setBounds(const BoundingBox* boxes, int count);
+};
+
+// bounds stored as steps of a power of two from the minimum corner of the node, min rounded
+// down and max rounded up so that the decoded boxes always contain the exact ones. Steps are
+// exact in float, decoding rounds only once whichever way the sum is evaluated
+template<int Width, typename Bound>
+struct alignas(32) WideNode {
+	static_assert(std::is_same<Bound, uint8_t>::value || std::is_same<Bound, uint16_t>::value, "bounds are quantized to 8 or 16 bits");
+
+	float origin[3];
+	uint32_t offset[Width];
+	uint16_t count[Width];
+	Bound bounds[6][Width];
+	int8_t exponent[3]; // the step along each axis is 2^exponent
+
+	static constexpr int width = Width;
+
+	inline float scale(int axis) const {
+		uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+
+		return scale;
+	}
+
+	inline float decode(int axis, float steps) const {
+		return origin[axis] + steps * scale(axis);
+	}
+
+	inline float bound(int plane, int i) const {
+		return decode(plane / 2, bounds[plane][i]);
+	}
+
+	// empty slots past count get inverted bounds
+	void setBounds(const BoundingBox* boxes, int count);
+};
+
+// the triangles of a leaf, Width at a time in SoA layout. Padding lanes have zero edges,
+// which gives them a NaN distance that never counts as a hit
+template<int Width>
+struct alignas(32) TrianglePacket {
+	float v0[3][Width];
+	float e1[3][Width];
+	float e2[3][Width];
+	uint32_t reference[Width]; // leaf reference of every lane
+
+	static constexpr int width = Width;
+};
+
+// a 4 or 8 wide tree collapsed from a binary one, sharing its triangles
+template<int Width, typename Bound = float>
+struct WideTree {
+	// what traversal reads, either the storage below or a mapped cache file
+	ArrayView<WideNode<Width, Bound>> nodes;
+	ArrayView<TrianglePacket<Width>> packets; // leaf children point at their first packet
+	ArrayView<uint32_t> triangles;
+	ArrayView<const Vertex> vertices;
+	BoundingBox bbox; // of the whole tree, packets missing it never enter the root
+
+	std::vector<WideNode<Width, Bound>, AlignedAllocator<WideNode<Width, Bound>, 64>> nodeStorage;
+	std::vector<TrianglePacket<Width>, AlignedAllocator<TrianglePacket<Width>, 64>> packetStorage;
+	std::shared_ptr<MappedFile> mapping;
+
+	static constexpr int width = Width;
+	static constexpr int nodeBits = 8 * sizeof(Bound);
+
+	WideTree() = default;
+	WideTree(const WideTree&) = delete;
+	WideTree(WideTree&&) = default;
+	WideTree& operator=(const WideTree&) = delete;
+	WideTree& operator=(WideTree&&) = default;
+
+	// repeatedly replaces the largest interior child by its children until the node is full
+	static WideTree collapse(const FlatTree& tree);
+
+	inline Triangle triangle(size_t reference) const {
+		const Vertex* v = &vertices[3 * static_cast<size_t>(triangles[reference])];
+		return { v, v + 1, v + 2 };
+	}
+
+	inline size_t memoryUsage() const {
+		return nodes.size() * sizeof(WideNode<Width, Bound>) + packets.size() * sizeof(TrianglePacket<Width>) + triangles.size() * sizeof(uint32_t);
+	}
+
+private:
+	uint32_t collapseNode(const FlatTree& tree, uint32_t index);
+	uint32_t packLeaf(const FlatTree& tree, uint32_t offset, uint32_t count);
+};
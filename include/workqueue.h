@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "alignedallocator.h"
+
+// hands out the items [0, count) to a fixed set of workers in ranges, each a fraction of what is left
+// so that they start large and shrink as the queue drains. Once nothing is left to hand out, idle
+// workers steal the back half of the largest range another worker has not finished yet
+class WorkQueue {
+public:
+	WorkQueue(size_t count, unsigned workers);
+
+	// the next item of worker, false once every item is taken
+	bool next(unsigned worker, size_t& item);
+
+private:
+	// the items a worker claimed and has not started yet, it takes them from the front and
+	// thieves from the back
+	struct alignas(64) Range {
+		std::mutex mutex;
+		size_t begin = 0;
+		size_t end = 0;
+	};
+
+	size_t count;
+	std::atomic_size_t claimed { 0 };
+	std::vector<Range, AlignedAllocator<Range, 64>> ranges;
+
+	bool claim(unsigned worker);
+	bool steal(unsigned worker);
+};
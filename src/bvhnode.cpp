@@ -0,0 +1,299 @@
+#include "bvhnode.h"
+
+#include <algorithm>
+
+#include "parallel.h"
+
+namespace {
+	struct BuildRef {
+		BoundingBox bbox;
+		glm::vec3 centroid;
+		uint32_t index;
+	};
+
+	struct Bin {
+		BoundingBox bbox = BoundingBox::empty();
+		size_t count = 0;
+	};
+
+	constexpr int maxBinCount = 64;
+
+	class BinnedBuilder {
+	private:
+		std::vector<Triangle>& triangles;
+		const BuildParams& params;
+		int binCount;
+
+		// refs are stably partitioned through scratch, so the tree does not depend on how the work is chunked
+		std::vector<BuildRef> refs;
+		std::vector<BuildRef> scratch;
+
+		bool isParallel(size_t count, unsigned threads) const {
+			return threads > 1 && count >= params.parallelCutoff;
+		}
+
+		int binIndex(const BuildRef& ref, int axis, float origin, float scale) const {
+			return std::min(binCount - 1, static_cast<int>((ref.centroid[axis] - origin) * scale));
+		}
+
+		std::unique_ptr<BvhNode> makeLeaf(size_t begin, size_t end, const BoundingBox& bbox) {
+			auto node = std::make_unique<BvhNode>();
+			node->bbox = bbox;
+			node->offset = static_cast<uint32_t>(begin);
+			node->count = static_cast<uint32_t>(end - begin);
+
+			return node;
+		}
+
+		size_t partition(size_t begin, size_t end, unsigned threads, int axis, int bin, float origin, float scale) {
+			if (threads <= 1) {
+				size_t l = begin, r = begin;
+
+				for (size_t i=begin; i<end; ++i) {
+					if (binIndex(refs[i], axis, origin, scale) < bin) {
+						refs[l++] = refs[i];
+					} else {
+						scratch[r++] = refs[i];
+					}
+				}
+
+				std::copy(scratch.begin() + static_cast<ptrdiff_t>(begin), scratch.begin() + static_cast<ptrdiff_t>(r), refs.begin() + static_cast<ptrdiff_t>(l));
+
+				return l;
+			}
+
+			std::vector<size_t> leftCounts(threads), rightCounts(threads);
+
+			size_t chunks = parallelFor(begin, end, threads, [&] (size_t chunkBegin, size_t chunkEnd, size_t chunk) {
+				for (size_t i=chunkBegin; i<chunkEnd; ++i) {
+					if (binIndex(refs[i], axis, origin, scale) < bin) {
+						leftCounts[chunk]++;
+					} else {
+						rightCounts[chunk]++;
+					}
+				}
+			});
+
+			std::vector<size_t> leftOffsets(chunks), rightOffsets(chunks);
+			size_t mid = begin;
+			for (size_t chunk=0; chunk<chunks; ++chunk) {
+				leftOffsets[chunk] = mid;
+				mid += leftCounts[chunk];
+			}
+
+			size_t rightOffset = mid;
+			for (size_t chunk=0; chunk<chunks; ++chunk) {
+				rightOffsets[chunk] = rightOffset;
+				rightOffset += rightCounts[chunk];
+			}
+
+			parallelFor(begin, end, threads, [&] (size_t chunkBegin, size_t chunkEnd, size_t chunk) {
+				size_t l = leftOffsets[chunk], r = rightOffsets[chunk];
+
+				for (size_t i=chunkBegin; i<chunkEnd; ++i) {
+					if (binIndex(refs[i], axis, origin, scale) < bin) {
+						scratch[l++] = refs[i];
+					} else {
+						scratch[r++] = refs[i];
+					}
+				}
+			});
+
+			parallelFor(begin, end, threads, [&] (size_t chunkBegin, size_t chunkEnd, size_t) {
+				std::copy(scratch.begin() + static_cast<ptrdiff_t>(chunkBegin), scratch.begin() + static_cast<ptrdiff_t>(chunkEnd), refs.begin() + static_cast<ptrdiff_t>(chunkBegin));
+			});
+
+			return mid;
+		}
+
+		void bounds(size_t begin, size_t end, BoundingBox& bbox, BoundingBox& centroidBox) const {
+			for (size_t i=begin; i<end; ++i) {
+				bbox.expand(refs[i].bbox);
+				centroidBox.expand({ refs[i].centroid, refs[i].centroid });
+			}
+		}
+
+		void bin(size_t begin, size_t end, const BoundingBox& centroidBox, const glm::vec3& scale, Bin* bins) const {
+			for (size_t i=begin; i<end; ++i) {
+				for (int axis=0; axis<3; ++axis) {
+					if (scale[axis] <= 0) continue;
+
+					Bin& bin = bins[axis * binCount + binIndex(refs[i], axis, centroidBox.min[axis], scale[axis])];
+					bin.bbox.expand(refs[i].bbox);
+					bin.count++;
+				}
+			}
+		}
+
+		std::unique_ptr<BvhNode> build(size_t begin, size_t end, int depth, unsigned threads) {
+			size_t count = end - begin;
+			bool parallel = isParallel(count, threads);
+			unsigned chunkThreads = parallel ? threads : 1;
+
+			BoundingBox bbox = BoundingBox::empty();
+			BoundingBox centroidBox = BoundingBox::empty();
+
+			if (parallel) {
+				std::vector<BoundingBox> chunkBoxes(chunkThreads, BoundingBox::empty());
+				std::vector<BoundingBox> chunkCentroidBoxes(chunkThreads, BoundingBox::empty());
+
+				size_t chunks = parallelFor(begin, end, chunkThreads, [&] (size_t chunkBegin, size_t chunkEnd, size_t chunk) {
+					bounds(chunkBegin, chunkEnd, chunkBoxes[chunk], chunkCentroidBoxes[chunk]);
+				});
+
+				for (size_t chunk=0; chunk<chunks; ++chunk) {
+					bbox.expand(chunkBoxes[chunk]);
+					centroidBox.expand(chunkCentroidBoxes[chunk]);
+				}
+			} else {
+				bounds(begin, end, bbox, centroidBox);
+			}
+
+			if (count <= 1 || depth >= params.maxDepth) {
+				return makeLeaf(begin, end, bbox);
+			}
+
+			glm::vec3 extent = centroidBox.max - centroidBox.min;
+			glm::vec3 scale;
+			for (int axis=0; axis<3; ++axis) {
+				scale[axis] = extent[axis] > 0 ? binCount / extent[axis] : 0;
+			}
+
+			Bin bins[3 * maxBinCount];
+			if (parallel) {
+				// every chunk bins its refs along all three axes, merging bounds and counts is exact
+				std::vector<std::vector<Bin>> chunkBins(chunkThreads, std::vector<Bin>(3 * static_cast<size_t>(binCount)));
+
+				size_t chunks = parallelFor(begin, end, chunkThreads, [&] (size_t chunkBegin, size_t chunkEnd, size_t chunk) {
+					bin(chunkBegin, chunkEnd, centroidBox, scale, chunkBins[chunk].data());
+				});
+
+				for (size_t chunk=0; chunk<chunks; ++chunk) {
+					for (int b=0; b<3 * binCount; ++b) {
+						bins[b].bbox.expand(chunkBins[chunk][static_cast<size_t>(b)].bbox);
+						bins[b].count += chunkBins[chunk][static_cast<size_t>(b)].count;
+					}
+				}
+			} else {
+				bin(begin, end, centroidBox, scale, bins);
+			}
+
+			float area = bbox.area();
+			float leafCost = params.intersectionCost * count;
+			float bestCost = std::numeric_limits<float>::max();
+			int bestAxis = -1;
+			int bestBin = 0;
+
+			float rightAreas[maxBinCount];
+			size_t rightCounts[maxBinCount];
+
+			for (int axis=0; axis<3; ++axis) {
+				if (extent[axis] <= 0) continue;
+
+				const Bin* axisBins = &bins[axis * binCount];
+
+				BoundingBox right = BoundingBox::empty();
+				size_t rightCount = 0;
+				for (int b=binCount - 1; b > 0; --b) {
+					right.expand(axisBins[b].bbox);
+					rightCount += axisBins[b].count;
+					rightAreas[b] = right.area();
+					rightCounts[b] = rightCount;
+				}
+
+				BoundingBox left = BoundingBox::empty();
+				size_t leftCount = 0;
+				for (int b=1; b < binCount; ++b) {
+					left.expand(axisBins[b - 1].bbox);
+					leftCount += axisBins[b - 1].count;
+
+					if (leftCount == 0 || rightCounts[b] == 0) continue;
+
+					float cost = params.traversalCost + params.intersectionCost * (left.area() * leftCount + rightAreas[b] * rightCounts[b]) / area;
+
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = b;
+					}
+				}
+			}
+
+			size_t mid;
+
+			if (bestAxis == -1) {
+				// every centroid coincides, only the leaf size can force a split
+				if (count <= params.maxLeafSize) {
+					return makeLeaf(begin, end, bbox);
+				}
+
+				bestAxis = 0;
+				mid = begin + count / 2;
+			} else {
+				if (bestCost >= leafCost && count <= params.maxLeafSize) {
+					return makeLeaf(begin, end, bbox);
+				}
+
+				mid = partition(begin, end, chunkThreads, bestAxis, bestBin, centroidBox.min[bestAxis], scale[bestAxis]);
+			}
+
+			auto node = std::make_unique<BvhNode>();
+			node->bbox = bbox;
+			node->axis = bestAxis;
+
+			unsigned rightThreads = parallel ? threads / 2 : 1;
+			unsigned leftThreads = parallel ? threads - rightThreads : threads;
+
+			parallelInvoke(parallel, [&] {
+				node->left = build(begin, mid, depth + 1, leftThreads);
+			}, [&] {
+				node->right = build(mid, end, depth + 1, rightThreads);
+			});
+
+			return node;
+		}
+
+	public:
+		BinnedBuilder(std::vector<Triangle>& triangles, const BuildParams& params) : triangles(triangles), params(params), binCount(std::min(maxBinCount, std::max(2, params.binCount))) {
+			size_t count = triangles.size();
+
+			refs.resize(count);
+			scratch.resize(count);
+			parallelFor(0, count, isParallel(count, params.threadCount) ? params.threadCount : 1, [&] (size_t begin, size_t end, size_t) {
+				for (size_t i=begin; i<end; ++i) {
+					refs[i].bbox = BoundingBox::fromTriangle(triangles[i]);
+					refs[i].centroid = refs[i].bbox.centroid();
+					refs[i].index = static_cast<uint32_t>(i);
+				}
+			});
+		}
+
+		std::unique_ptr<BvhNode> build() {
+			auto root = build(0, refs.size(), 0, std::max(1u, params.threadCount));
+
+			std::vector<Triangle> reordered(triangles.size());
+			for (size_t i=0; i<refs.size(); ++i) {
+				reordered[i] = triangles[refs[i].index];
+			}
+			triangles.swap(reordered);
+
+			return root;
+		}
+	};
+}
+
+std::unique_ptr<BvhNode> BvhNode::buildBinned(std::vector<Triangle>& triangles, const BuildParams& params) {
+	return BinnedBuilder(triangles, params).build();
+}
+
+std::unique_ptr<BvhNode> BvhNode::build(std::vector<Triangle>& triangles, const BuildParams& params) {
+	if (params.builder == BuildParams::Builder::Lbvh) {
+		return buildLbvh(triangles, params);
+	}
+
+	if (params.builder == BuildParams::Builder::Sbvh) {
+		return buildSbvh(triangles, params);
+	}
+
+	return buildBinned(triangles, params);
+}
@@ -0,0 +1,94 @@
+#include "flattree.h"
+
+#include <algorithm>
+
+void FlatTree::flattenLeaf(const BoundingBox& bbox, uint32_t offset, uint32_t count, uint16_t axis) {
+	size_t index = nodeStorage.size();
+	nodeStorage.emplace_back();
+	nodeStorage[index].bbox = bbox;
+	nodeStorage[index].axis = axis;
+
+	if (count <= maxLeafTriangles) {
+		nodeStorage[index].offset = offset;
+		nodeStorage[index].count = static_cast<uint16_t>(count);
+		return;
+	}
+
+	auto centroid = [&] (uint32_t reference) {
+		const Vertex* v = &vertices[3 * static_cast<size_t>(reference)];
+		return (v[0].pos + v[1].pos + v[2].pos) / 3.0f;
+	};
+
+	uint32_t* first = &triangleStorage[offset];
+	uint32_t* last = first + count;
+
+	BoundingBox centroids = BoundingBox::empty();
+	for (uint32_t* t=first; t<last; ++t) {
+		glm::vec3 c = centroid(*t);
+		centroids.expand({ c, c });
+	}
+
+	glm::vec3 extent = centroids.max - centroids.min;
+	int splitAxis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+	// only the order inside the leaf changes, records are computed after flattening
+	uint32_t leftCount = count / 2;
+	std::nth_element(first, first + leftCount, last, [&] (uint32_t a, uint32_t b) {
+		return centroid(a)[splitAxis] < centroid(b)[splitAxis];
+	});
+
+	BoundingBox halves[2] = { BoundingBox::empty(), BoundingBox::empty() };
+	for (uint32_t i=0; i<count; ++i) {
+		const Vertex* v = &vertices[3 * static_cast<size_t>(first[i])];
+		halves[i >= leftCount].expand(Triangle{ v, v + 1, v + 2 });
+	}
+
+	for (BoundingBox& half : halves) {
+		half.min = glm::max(half.min, bbox.min);
+		half.max = glm::min(half.max, bbox.max);
+	}
+
+	nodeStorage[index].axis = static_cast<uint16_t>(splitAxis);
+	flattenLeaf(halves[0], offset, leftCount, axis);
+	nodeStorage[index].offset = static_cast<uint32_t>(nodeStorage.size());
+	nodeStorage[index].count = 0;
+	flattenLeaf(halves[1], offset + leftCount, count - leftCount, axis);
+}
+
+void FlatTree::updateRecords() {
+	for (size_t i=0; i<records.size(); ++i) {
+		records[i] = TriangleRecord::fromTriangle(triangle(i));
+	}
+}
+
+void FlatTree::refit() {
+	updateRecords();
+
+	// children always come after their parent, so a reverse sweep sees them first
+	for (size_t i=nodes.size(); i-- > 0;) {
+		FlatNode& node = nodes[i];
+
+		if (node.isLeaf()) {
+			node.bbox = BoundingBox::empty();
+			for (uint32_t j=node.offset; j<node.offset + node.count; ++j) {
+				node.bbox.expand(triangle(j));
+			}
+		} else {
+			node.bbox = nodes[i + 1].bbox;
+			node.bbox.expand(nodes[node.offset].bbox);
+		}
+	}
+}
+
+float FlatTree::sahCost(const BuildParams& params) const {
+	if (nodes.empty() || nodes[0].bbox.area() <= 0) {
+		return 0;
+	}
+
+	float cost = 0;
+	for (const FlatNode& node : nodes) {
+		cost += node.bbox.area() * (node.isLeaf() ? params.intersectionCost * node.count : params.traversalCost);
+	}
+
+	return cost / nodes[0].bbox.area();
+}
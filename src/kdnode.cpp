@@ -1,26 +1,438 @@
 #include "kdnode.h"
 
 #include <algorithm>
+#include <numeric>
+#include <array>
+#include <mutex>
 
-KdNode::KdNode(std::vector<Triangle>::iterator begin, std::vector<Triangle>::iterator end, int depth) {
-	ptrdiff_t len = end - begin;
+#include "parallel.h"
 
-	if (len == 1) {
-		triangle = *begin;
-		bbox = BoundingBox::fromTriangle(*begin);
-	} else if (len > 1) {
-		auto mid = begin + len / 2;
+KdNode::KdNode(std::vector<Triangle>& triangles, size_t begin, size_t end, const BuildParams& params, unsigned threads, int depth) {
+	size_t len = end - begin;
+	size_t maxLeafSize = std::max<size_t>(1, params.maxLeafSize);
 
-		std::nth_element(begin, mid, end, [depth] (const Triangle& t0, const Triangle& t1) {
+	if (len >= 1 && len <= maxLeafSize) {
+		offset = static_cast<uint32_t>(begin);
+		count = static_cast<uint32_t>(len);
+
+		bbox = BoundingBox::empty();
+		for (size_t i=begin; i<end; ++i) {
+			bbox.expand(triangles[i]);
+		}
+	} else if (len > maxLeafSize) {
+		size_t mid = begin + len / 2;
+
+		auto first = triangles.begin();
+		std::nth_element(first + static_cast<ptrdiff_t>(begin), first + static_cast<ptrdiff_t>(mid), first + static_cast<ptrdiff_t>(end), [depth] (const Triangle& t0, const Triangle& t1) {
 			return t0.v0->pos[depth] + t0.v1->pos[depth] + t0.v2->pos[depth] < t1.v0->pos[depth] + t1.v1->pos[depth] + t1.v2->pos[depth];
 		});
 
+		axis = depth;
 		depth = (depth + 1) % 3;
 
-		left = std::make_unique<KdNode>(begin, mid, depth);
-		right = std::make_unique<KdNode>(mid, end, depth);
+		bool fork = threads > 1 && len >= params.parallelCutoff;
+		unsigned rightThreads = fork ? threads / 2 : 1;
+		unsigned leftThreads = fork ? threads - rightThreads : threads;
+
+		parallelInvoke(fork, [&] {
+			left = std::make_unique<KdNode>(triangles, begin, mid, params, leftThreads, depth);
+		}, [&] {
+			right = std::make_unique<KdNode>(triangles, mid, end, params, rightThreads, depth);
+		});
 
 		bbox = left->bbox;
 		bbox.expand(right->bbox);
 	}
 }
+
+namespace {
+	// scales the cost of a split that leaves one side empty, so that empty space gets cut off
+	// even where the heuristic alone would only just favour it
+	constexpr float emptyBonus = 0.8f;
+
+	// where the bounds of a triangle in a cell start or end along one axis, referring to the
+	// triangle by its position in the reference list of the cell
+	struct Event {
+		enum Type : uint8_t { End, Planar, Start };
+
+		float pos;
+		uint32_t ref;
+		Type type;
+
+		// at the same position ends come before planar triangles and those before starts
+		inline bool operator<(const Event& other) const {
+			return pos < other.pos || (pos == other.pos && type < other.type);
+		}
+	};
+
+	using Events = std::array<std::vector<Event>, 3>;
+
+	struct Split {
+		float cost = std::numeric_limits<float>::max();
+		int axis = -1;
+		float pos = 0;
+		bool planarLeft = false; // side of the triangles lying in the split plane
+		size_t leftCount = 0;
+		size_t rightCount = 0;
+	};
+
+	enum Side : uint8_t { Both, LeftOnly, RightOnly };
+
+	// bounds of the part of the triangle inside cell, empty if none of it is
+	BoundingBox clip(const Triangle& triangle, const BoundingBox& cell) {
+		// a triangle clipped by six planes has at most nine corners
+		glm::vec3 polygon[9] = { triangle.v0->pos, triangle.v1->pos, triangle.v2->pos };
+		glm::vec3 clipped[9];
+		int corners = 3;
+
+		for (int axis=0; axis<3 && corners > 0; ++axis) {
+			for (int side=0; side<2 && corners > 0; ++side) {
+				float plane = side ? cell.max[axis] : cell.min[axis];
+				int kept = 0;
+
+				for (int i=0; i<corners; ++i) {
+					const glm::vec3& a = polygon[i];
+					const glm::vec3& b = polygon[(i + 1) % corners];
+					bool aInside = side ? a[axis] <= plane : a[axis] >= plane;
+					bool bInside = side ? b[axis] <= plane : b[axis] >= plane;
+
+					if (aInside) {
+						clipped[kept++] = a;
+					}
+
+					if (aInside != bInside) {
+						glm::vec3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+						p[axis] = plane;
+						clipped[kept++] = p;
+					}
+				}
+
+				std::copy(clipped, clipped + kept, polygon);
+				corners = kept;
+			}
+		}
+
+		BoundingBox bbox = BoundingBox::empty();
+		for (int i=0; i<corners; ++i) {
+			bbox.expand({ polygon[i], polygon[i] });
+		}
+
+		// rounding may push the intersections just outside the cell
+		return { glm::max(bbox.min, cell.min), glm::min(bbox.max, cell.max) };
+	}
+
+	void addEvents(Events& events, uint32_t ref, const BoundingBox& bbox) {
+		for (int axis=0; axis<3; ++axis) {
+			if (bbox.min[axis] == bbox.max[axis]) {
+				events[axis].push_back({ bbox.min[axis], ref, Event::Planar });
+			} else {
+				events[axis].push_back({ bbox.min[axis], ref, Event::Start });
+				events[axis].push_back({ bbox.max[axis], ref, Event::End });
+			}
+		}
+	}
+
+	class SahBuilder {
+	private:
+		std::vector<Triangle>& triangles;
+		const BuildParams& params;
+
+		// leaves keep their references here until the tree is laid out depth first
+		std::mutex leafMutex;
+		std::vector<std::vector<uint32_t>> leafReferences;
+
+		bool isParallel(size_t count, unsigned threads) const {
+			return threads > 1 && count >= params.parallelCutoff;
+		}
+
+		float cost(float leftArea, size_t leftCount, float rightArea, size_t rightCount, float inverseArea) const {
+			float cost = params.traversalCost + params.intersectionCost * (leftArea * leftCount + rightArea * rightCount) * inverseArea;
+			return leftCount == 0 || rightCount == 0 ? emptyBonus * cost : cost;
+		}
+
+		// every plane an event lies in, with the triangles in it tried on either side
+		Split sweep(const std::vector<Event>& list, int axis, const BoundingBox& cell, size_t count) const {
+			// the cells on either side share the faces across the axis and split the ones along it
+			glm::vec3 size = cell.max - cell.min;
+			float across = size[(axis + 1) % 3] * size[(axis + 2) % 3];
+			float along = size[(axis + 1) % 3] + size[(axis + 2) % 3];
+			float inverseArea = 1 / (2 * (across + size[axis] * along));
+
+			size_t left = 0, right = count;
+			Split best;
+
+			for (size_t i=0; i<list.size();) {
+				float pos = list[i].pos;
+				size_t ends = 0, planars = 0, starts = 0;
+
+				for (; i<list.size() && list[i].pos == pos && list[i].type == Event::End; ++i) ends++;
+				for (; i<list.size() && list[i].pos == pos && list[i].type == Event::Planar; ++i) planars++;
+				for (; i<list.size() && list[i].pos == pos && list[i].type == Event::Start; ++i) starts++;
+
+				right -= ends + planars;
+
+				// a plane on the cell boundary would only leave an empty cell behind
+				if (pos > cell.min[axis] && pos < cell.max[axis]) {
+					float leftArea = 2 * (across + (pos - cell.min[axis]) * along);
+					float rightArea = 2 * (across + (cell.max[axis] - pos) * along);
+
+					for (bool planarLeft : { true, false }) {
+						float splitCost = planarLeft ? cost(leftArea, left + planars, rightArea, right, inverseArea) : cost(leftArea, left, rightArea, right + planars, inverseArea);
+
+						if (splitCost < best.cost) {
+							best.cost = splitCost;
+							best.axis = axis;
+							best.pos = pos;
+							best.planarLeft = planarLeft;
+							best.leftCount = planarLeft ? left + planars : left;
+							best.rightCount = planarLeft ? right : right + planars;
+						}
+					}
+				}
+
+				left += starts + planars;
+			}
+
+			return best;
+		}
+
+		std::unique_ptr<KdNode> makeLeaf(std::vector<uint32_t>& refs, const BoundingBox& cell) {
+			auto node = std::make_unique<KdNode>();
+			node->bbox = cell;
+			node->count = static_cast<uint32_t>(refs.size());
+
+			std::lock_guard<std::mutex> lg(leafMutex);
+			node->offset = static_cast<uint32_t>(leafReferences.size());
+			leafReferences.push_back(std::move(refs));
+
+			return node;
+		}
+
+		void addClipped(uint32_t triangle, const BoundingBox& cell, std::vector<uint32_t>& refs, Events& events) const {
+			BoundingBox bbox = clip(triangles[triangle], cell);
+
+			// rounding may leave no part of a straddling triangle on one side
+			if (bbox.min.x <= bbox.max.x) {
+				addEvents(events, static_cast<uint32_t>(refs.size()), bbox);
+				refs.push_back(triangle);
+			}
+		}
+
+		// the events of triangles on one side keep their order, those of the triangles straddling the plane
+		// were clipped to both cells and get sorted and merged in. So only the root events ever get sorted in full
+		void splitEvents(const std::vector<Event>& list, const std::vector<Side>& sides, const std::vector<uint32_t>& indices,
+			std::vector<Event>& leftClipped, std::vector<Event>& rightClipped, std::vector<Event>& left, std::vector<Event>& right) const {
+			std::sort(leftClipped.begin(), leftClipped.end());
+			std::sort(rightClipped.begin(), rightClipped.end());
+
+			left.reserve(list.size() + leftClipped.size());
+			right.reserve(list.size() + rightClipped.size());
+			auto leftNext = leftClipped.begin(), rightNext = rightClipped.begin();
+
+			for (const Event& event : list) {
+				Event moved { event.pos, indices[event.ref], event.type };
+
+				if (sides[event.ref] == LeftOnly) {
+					for (; leftNext != leftClipped.end() && *leftNext < moved; ++leftNext) left.push_back(*leftNext);
+					left.push_back(moved);
+				} else if (sides[event.ref] == RightOnly) {
+					for (; rightNext != rightClipped.end() && *rightNext < moved; ++rightNext) right.push_back(*rightNext);
+					right.push_back(moved);
+				}
+			}
+
+			left.insert(left.end(), leftNext, leftClipped.end());
+			right.insert(right.end(), rightNext, rightClipped.end());
+		}
+
+		std::unique_ptr<KdNode> build(std::vector<uint32_t>& refs, Events& events, const BoundingBox& cell, int depth, unsigned threads) {
+			size_t count = refs.size();
+			bool parallel = isParallel(count, threads);
+
+			if (count == 0 || depth >= params.maxDepth) {
+				return makeLeaf(refs, cell);
+			}
+
+			Split best;
+
+			if (cell.area() > 0) {
+				std::array<Split, 3> splits;
+
+				auto sweepAxes = [&] (size_t axisBegin, size_t axisEnd, size_t) {
+					for (size_t axis=axisBegin; axis<axisEnd; ++axis) {
+						splits[axis] = sweep(events[axis], static_cast<int>(axis), cell, count);
+					}
+				};
+
+				// small nodes are far too many to pay for the pool
+				if (parallel) {
+					parallelFor(0, 3, 3, sweepAxes);
+				} else {
+					sweepAxes(0, 3, 0);
+				}
+
+				// same tie breaking as a single sweep over x, y and z
+				for (const Split& split : splits) {
+					if (split.cost < best.cost) {
+						best = split;
+					}
+				}
+			}
+
+			float leafCost = params.intersectionCost * count;
+			if (best.axis == -1 || (best.cost >= leafCost && count <= params.maxLeafSize)) {
+				return makeLeaf(refs, cell);
+			}
+
+			int axis = best.axis;
+			BoundingBox leftCell = cell, rightCell = cell;
+			leftCell.max[axis] = best.pos;
+			rightCell.min[axis] = best.pos;
+
+			// cutting off empty space only shrinks the cell, every triangle and its events stay as they are
+			if (best.leftCount == 0) {
+				return build(refs, events, rightCell, depth + 1, threads);
+			} else if (best.rightCount == 0) {
+				return build(refs, events, leftCell, depth + 1, threads);
+			}
+
+			std::vector<Side> sides(count, Both);
+
+			for (const Event& event : events[axis]) {
+				if (event.type == Event::End && event.pos <= best.pos) {
+					sides[event.ref] = LeftOnly;
+				} else if (event.type == Event::Start && event.pos >= best.pos) {
+					sides[event.ref] = RightOnly;
+				} else if (event.type == Event::Planar) {
+					sides[event.ref] = event.pos < best.pos || (event.pos == best.pos && best.planarLeft) ? LeftOnly : RightOnly;
+				}
+			}
+
+			std::vector<uint32_t> leftRefs, rightRefs;
+			std::vector<uint32_t> indices(count); // in the reference list of the one side of the triangle
+			Events leftClipped, rightClipped;
+			leftRefs.reserve(count);
+			rightRefs.reserve(count);
+
+			for (size_t i=0; i<count; ++i) {
+				if (sides[i] == LeftOnly) {
+					indices[i] = static_cast<uint32_t>(leftRefs.size());
+					leftRefs.push_back(refs[i]);
+				} else if (sides[i] == RightOnly) {
+					indices[i] = static_cast<uint32_t>(rightRefs.size());
+					rightRefs.push_back(refs[i]);
+				} else {
+					addClipped(refs[i], leftCell, leftRefs, leftClipped);
+					addClipped(refs[i], rightCell, rightRefs, rightClipped);
+				}
+			}
+
+			// a forced split that duplicates every triangle gets nowhere
+			if (leftRefs.size() == count && rightRefs.size() == count && best.cost >= leafCost) {
+				return makeLeaf(refs, cell);
+			}
+
+			Events leftEvents, rightEvents;
+			auto splitAxes = [&] (size_t axisBegin, size_t axisEnd, size_t) {
+				for (size_t axis=axisBegin; axis<axisEnd; ++axis) {
+					splitEvents(events[axis], sides, indices, leftClipped[axis], rightClipped[axis], leftEvents[axis], rightEvents[axis]);
+				}
+			};
+
+			if (parallel) {
+				parallelFor(0, 3, 3, splitAxes);
+			} else {
+				splitAxes(0, 3, 0);
+			}
+
+			std::vector<uint32_t>().swap(refs);
+			Events().swap(events);
+
+			// rounding may have left no part of the straddling triangles on a side that had only those
+			if (leftRefs.empty()) {
+				return build(rightRefs, rightEvents, rightCell, depth + 1, threads);
+			} else if (rightRefs.empty()) {
+				return build(leftRefs, leftEvents, leftCell, depth + 1, threads);
+			}
+
+			auto node = std::make_unique<KdNode>();
+			node->bbox = cell;
+			node->axis = axis;
+
+			unsigned rightThreads = parallel ? threads / 2 : 1;
+			unsigned leftThreads = parallel ? threads - rightThreads : threads;
+
+			parallelInvoke(parallel, [&] {
+				node->left = build(leftRefs, leftEvents, leftCell, depth + 1, leftThreads);
+			}, [&] {
+				node->right = build(rightRefs, rightEvents, rightCell, depth + 1, rightThreads);
+			});
+
+			return node;
+		}
+
+		void relayout(KdNode& node, const std::vector<Triangle>& original) {
+			if (node.left) {
+				relayout(*node.left, original);
+				relayout(*node.right, original);
+			} else {
+				const std::vector<uint32_t>& indices = leafReferences[node.offset];
+
+				node.offset = static_cast<uint32_t>(triangles.size());
+				for (uint32_t index : indices) {
+					triangles.push_back(original[index]);
+				}
+			}
+		}
+
+	public:
+		SahBuilder(std::vector<Triangle>& triangles, const BuildParams& params) : triangles(triangles), params(params) {}
+
+		std::unique_ptr<KdNode> build() {
+			if (triangles.empty()) {
+				return std::make_unique<KdNode>();
+			}
+
+			size_t count = triangles.size();
+			unsigned threads = isParallel(count, params.threadCount) ? params.threadCount : 1;
+
+			std::vector<uint32_t> refs(count);
+			BoundingBox cell = BoundingBox::empty();
+			Events events;
+
+			for (size_t i=0; i<count; ++i) {
+				BoundingBox bbox = BoundingBox::fromTriangle(triangles[i]);
+
+				refs[i] = static_cast<uint32_t>(i);
+				cell.expand(bbox);
+				addEvents(events, refs[i], bbox);
+			}
+
+			parallelFor(0, 3, std::min(threads, 3u), [&] (size_t axisBegin, size_t axisEnd, size_t) {
+				for (size_t axis=axisBegin; axis<axisEnd; ++axis) {
+					std::sort(events[axis].begin(), events[axis].end());
+				}
+			});
+
+			auto root = build(refs, events, cell, 0, std::max(1u, params.threadCount));
+
+			std::vector<Triangle> original;
+			original.swap(triangles);
+			relayout(*root, original);
+
+			return root;
+		}
+	};
+}
+
+std::unique_ptr<KdNode> KdNode::buildSah(std::vector<Triangle>& triangles, const BuildParams& params) {
+	return SahBuilder(triangles, params).build();
+}
+
+std::unique_ptr<KdNode> KdNode::build(std::vector<Triangle>& triangles, const BuildParams& params) {
+	if (params.builder == BuildParams::Builder::Median) {
+		return std::make_unique<KdNode>(triangles, 0, triangles.size(), params, std::max(1u, params.threadCount));
+	}
+
+	return buildSah(triangles, params);
+}
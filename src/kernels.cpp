@@ -0,0 +1,67 @@
+#include "kernels.h"
+
+#include <stdexcept>
+
+// the instruction set the whole program is compiled for
+#define KERNEL_TABLE baselineKernels
+#define KERNEL_SUPPORTED [] { return true; }
+
+#ifdef __SSE2__
+#define KERNEL_SSE2
+#endif
+
+#ifdef __AVX__
+#define KERNEL_AVX
+#endif
+
+#if defined(__AVX2__)
+#define KERNEL_NAME "avx2"
+#elif defined(__AVX__)
+#define KERNEL_NAME "avx"
+#elif defined(__SSE2__)
+#define KERNEL_NAME "sse2"
+#else
+#define KERNEL_NAME "generic"
+#endif
+
+#include "raykernels.h"
+
+namespace {
+	const Kernels* bestKernels() {
+		for (const Kernels* kernels : Kernels::variants()) {
+			if (kernels->supported()) {
+				return kernels;
+			}
+		}
+
+		return &baselineKernels;
+	}
+}
+
+const Kernels* Kernels::active = bestKernels();
+
+std::vector<const Kernels*> Kernels::variants() {
+	std::vector<const Kernels*> variants;
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__AVX2__)
+	variants.push_back(&avx2Kernels);
+#endif
+	variants.push_back(&baselineKernels);
+
+	return variants;
+}
+
+void Kernels::select(const std::string& name) {
+	for (const Kernels* kernels : variants()) {
+		if (name.empty() ? kernels->supported() : name == kernels->name) {
+			if (!kernels->supported()) {
+				throw std::runtime_error("this cpu does not support the " + name + " kernels!");
+			}
+
+			active = kernels;
+			return;
+		}
+	}
+
+	throw std::runtime_error("unknown kernels '" + name + "'!");
+}
@@ -0,0 +1,21 @@
+#include "kernels.h"
+
+// only what is defined below gets compiled for AVX2, the inline functions of every header
+// above keep the baseline instruction set and stay safe to share with the rest of the program
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__AVX2__)
+// runs before any avx2 code, during static initialization
+static bool avx2Supported() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#pragma GCC target("avx2")
+
+#define KERNEL_TABLE avx2Kernels
+#define KERNEL_NAME "avx2"
+#define KERNEL_SUPPORTED avx2Supported
+#define KERNEL_SSE2
+#define KERNEL_AVX
+
+#include "raykernels.h"
+#endif
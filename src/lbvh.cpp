@@ -0,0 +1,375 @@
+#include "bvhnode.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <queue>
+
+#include "parallel.h"
+
+namespace {
+	constexpr uint32_t leafFlag = 0x80000000u;
+
+	// spreads the lowest 21 bits of v so that there are two zero bits between each of them
+	inline uint64_t expandBits(uint64_t v) {
+		v &= 0x1FFFFF;
+		v = (v | v << 32) & 0x1F00000000FFFFull;
+		v = (v | v << 16) & 0x1F0000FF0000FFull;
+		v = (v | v << 8) & 0x100F00F00F00F00Full;
+		v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+		v = (v | v << 2) & 0x1249249249249249ull;
+
+		return v;
+	}
+
+	// stable least significant digit radix sort of keys and their values, 8 bits per pass
+	void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int bits, unsigned threads) {
+		size_t count = keys.size();
+		std::vector<uint64_t> tmpKeys(count);
+		std::vector<uint32_t> tmpValues(count);
+		std::vector<std::array<size_t, 256>> histograms(threads);
+
+		for (int shift=0; shift<bits; shift += 8) {
+			for (auto& histogram : histograms) {
+				histogram.fill(0);
+			}
+
+			size_t chunks = parallelFor(0, count, threads, [&] (size_t begin, size_t end, size_t chunk) {
+				for (size_t i=begin; i<end; ++i) {
+					histograms[chunk][(keys[i] >> shift) & 0xFF]++;
+				}
+			});
+
+			size_t offset = 0;
+			for (size_t digit=0; digit<256; ++digit) {
+				for (size_t chunk=0; chunk<chunks; ++chunk) {
+					size_t digitCount = histograms[chunk][digit];
+					histograms[chunk][digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			parallelFor(0, count, threads, [&] (size_t begin, size_t end, size_t chunk) {
+				std::array<size_t, 256>& offsets = histograms[chunk];
+
+				for (size_t i=begin; i<end; ++i) {
+					size_t dst = offsets[(keys[i] >> shift) & 0xFF]++;
+					tmpKeys[dst] = keys[i];
+					tmpValues[dst] = values[i];
+				}
+			});
+
+			keys.swap(tmpKeys);
+			values.swap(tmpValues);
+		}
+	}
+
+	struct Cluster {
+		std::unique_ptr<BvhNode> node;
+		size_t count;
+	};
+
+	class LbvhBuilder {
+	private:
+		std::vector<Triangle>& triangles;
+		const BuildParams& params;
+		unsigned threads;
+		size_t maxLeafSize;
+		int bitsPerAxis;
+
+		std::vector<BoundingBox> bboxes;
+		std::vector<uint64_t> codes;
+		std::vector<uint32_t> order;
+
+		// internal node i splits the sorted primitives between i and i + 1, its children are
+		// either other internal nodes or, flagged with leafFlag, single primitives
+		std::vector<int> deltas;
+		std::vector<uint32_t> leftChild;
+		std::vector<uint32_t> rightChild;
+
+		int delta(size_t i) const {
+			uint64_t diff = codes[i] ^ codes[i + 1];
+
+			// duplicated codes are told apart by their position
+			return diff ? __builtin_clzll(diff) : 64 + __builtin_clzll(static_cast<uint64_t>(i ^ (i + 1)));
+		}
+
+		void computeCodes() {
+			size_t count = triangles.size();
+			std::vector<BoundingBox> chunkBoxes(threads, BoundingBox::empty());
+
+			bboxes.resize(count);
+			size_t chunks = parallelFor(0, count, threads, [&] (size_t begin, size_t end, size_t chunk) {
+				for (size_t i=begin; i<end; ++i) {
+					bboxes[i] = BoundingBox::fromTriangle(triangles[i]);
+
+					glm::vec3 centroid = bboxes[i].centroid();
+					chunkBoxes[chunk].expand({ centroid, centroid });
+				}
+			});
+
+			BoundingBox centroidBox = BoundingBox::empty();
+			for (size_t chunk=0; chunk<chunks; ++chunk) {
+				centroidBox.expand(chunkBoxes[chunk]);
+			}
+
+			float cells = static_cast<float>((1u << bitsPerAxis) - 1);
+			glm::vec3 extent = centroidBox.max - centroidBox.min;
+			glm::vec3 scale;
+			for (int axis=0; axis<3; ++axis) {
+				scale[axis] = extent[axis] > 0 ? cells / extent[axis] : 0;
+			}
+
+			codes.resize(count);
+			order.resize(count);
+			parallelFor(0, count, threads, [&] (size_t begin, size_t end, size_t) {
+				for (size_t i=begin; i<end; ++i) {
+					glm::vec3 cell = (bboxes[i].centroid() - centroidBox.min) * scale;
+
+					codes[i] = expandBits(static_cast<uint64_t>(cell.x)) << 2 | expandBits(static_cast<uint64_t>(cell.y)) << 1 | expandBits(static_cast<uint64_t>(cell.z));
+					order[i] = static_cast<uint32_t>(i);
+				}
+			});
+
+			radixSort(codes, order, 3 * bitsPerAxis, threads);
+		}
+
+		// the binary radix tree is the cartesian tree of the common prefix lengths of neighbouring codes,
+		// built in linear time with a stack. Returns the root
+		uint32_t emitHierarchy() {
+			size_t count = codes.size();
+
+			deltas.resize(count - 1);
+			parallelFor(0, count - 1, threads, [&] (size_t begin, size_t end, size_t) {
+				for (size_t i=begin; i<end; ++i) {
+					deltas[i] = delta(i);
+				}
+			});
+
+			leftChild.resize(count - 1);
+			rightChild.resize(count - 1);
+
+			std::vector<uint32_t> stack;
+			for (uint32_t i=0; i<count - 1; ++i) {
+				uint32_t last = leafFlag | i;
+
+				while (!stack.empty() && deltas[stack.back()] > deltas[i]) {
+					last = stack.back();
+					stack.pop_back();
+				}
+
+				leftChild[i] = last;
+				rightChild[i] = leafFlag | (i + 1);
+
+				if (!stack.empty()) {
+					rightChild[stack.back()] = i;
+				}
+
+				stack.push_back(i);
+			}
+
+			return stack.front();
+		}
+
+		int splitAxis(uint32_t node) const {
+			// codes interleave x, y and z from their most significant bit on
+			int bit = deltas[node] - (64 - 3 * bitsPerAxis);
+
+			return bit >= 0 && bit < 3 * bitsPerAxis ? bit % 3 : 0;
+		}
+
+		std::unique_ptr<BvhNode> makeNode(uint32_t ref, size_t first, size_t last, unsigned nodeThreads) {
+			auto node = std::make_unique<BvhNode>();
+			size_t count = last - first + 1;
+
+			if (count <= maxLeafSize) {
+				node->offset = static_cast<uint32_t>(first);
+				node->count = static_cast<uint32_t>(count);
+
+				node->bbox = BoundingBox::empty();
+				for (size_t i=first; i<=last; ++i) {
+					node->bbox.expand(bboxes[order[i]]);
+				}
+
+				return node;
+			}
+
+			bool parallel = nodeThreads > 1 && count >= params.parallelCutoff;
+			unsigned rightThreads = parallel ? nodeThreads / 2 : 1;
+			unsigned leftThreads = parallel ? nodeThreads - rightThreads : nodeThreads;
+
+			parallelInvoke(parallel, [&] {
+				node->left = makeNode(leftChild[ref], first, ref, leftThreads);
+			}, [&] {
+				node->right = makeNode(rightChild[ref], ref + 1, last, rightThreads);
+			});
+
+			node->bbox = node->left->bbox;
+			node->bbox.expand(node->right->bbox);
+			node->axis = splitAxis(ref);
+
+			return node;
+		}
+
+		// full SAH sweep over whole morton subtrees, they are few enough to simply sort
+		std::unique_ptr<BvhNode> buildTop(std::vector<Cluster>& clusters, size_t begin, size_t end) {
+			if (end - begin == 1) {
+				return std::move(clusters[begin].node);
+			}
+
+			auto node = std::make_unique<BvhNode>();
+			node->bbox = BoundingBox::empty();
+			for (size_t i=begin; i<end; ++i) {
+				node->bbox.expand(clusters[i].node->bbox);
+			}
+
+			auto first = clusters.begin() + static_cast<ptrdiff_t>(begin);
+			auto last = clusters.begin() + static_cast<ptrdiff_t>(end);
+			std::vector<float> rightCosts(end - begin);
+			float bestCost = std::numeric_limits<float>::max();
+			int bestAxis = 0;
+			size_t bestMid = begin + 1;
+
+			for (int axis=0; axis<3; ++axis) {
+				std::stable_sort(first, last, [axis] (const Cluster& a, const Cluster& b) {
+					return a.node->bbox.centroid()[axis] < b.node->bbox.centroid()[axis];
+				});
+
+				BoundingBox right = BoundingBox::empty();
+				size_t rightCount = 0;
+				for (size_t i=end; i-- > begin + 1;) {
+					right.expand(clusters[i].node->bbox);
+					rightCount += clusters[i].count;
+					rightCosts[i - begin] = right.area() * rightCount;
+				}
+
+				BoundingBox left = BoundingBox::empty();
+				size_t leftCount = 0;
+				for (size_t i=begin + 1; i<end; ++i) {
+					left.expand(clusters[i - 1].node->bbox);
+					leftCount += clusters[i - 1].count;
+
+					float cost = left.area() * leftCount + rightCosts[i - begin];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestMid = i;
+					}
+				}
+			}
+
+			std::stable_sort(first, last, [bestAxis] (const Cluster& a, const Cluster& b) {
+				return a.node->bbox.centroid()[bestAxis] < b.node->bbox.centroid()[bestAxis];
+			});
+
+			node->axis = bestAxis;
+			node->left = buildTop(clusters, begin, bestMid);
+			node->right = buildTop(clusters, bestMid, end);
+
+			return node;
+		}
+
+		std::unique_ptr<BvhNode> buildClustered(uint32_t root) {
+			struct Range {
+				uint32_t ref;
+				size_t first, last;
+
+				bool operator<(const Range& other) const {
+					size_t count = last - first, otherCount = other.last - other.first;
+					return count < otherCount || (count == otherCount && first > other.first);
+				}
+			};
+
+			// keep opening the largest subtree until there are enough of them
+			std::priority_queue<Range> queue;
+			std::vector<Range> ranges;
+			queue.push({ root, 0, codes.size() - 1 });
+
+			while (!queue.empty() && queue.size() + ranges.size() < params.lbvhSahClusters) {
+				Range range = queue.top();
+				queue.pop();
+
+				if (range.ref & leafFlag || range.last - range.first + 1 <= maxLeafSize) {
+					ranges.push_back(range);
+					continue;
+				}
+
+				queue.push({ leftChild[range.ref], range.first, range.ref });
+				queue.push({ rightChild[range.ref], range.ref + 1, range.last });
+			}
+
+			for (; !queue.empty(); queue.pop()) {
+				ranges.push_back(queue.top());
+			}
+
+			std::sort(ranges.begin(), ranges.end(), [] (const Range& a, const Range& b) {
+				return a.first < b.first;
+			});
+
+			std::vector<Cluster> clusters(ranges.size());
+			parallelFor(0, ranges.size(), threads, [&] (size_t begin, size_t end, size_t) {
+				for (size_t i=begin; i<end; ++i) {
+					clusters[i].node = makeNode(ranges[i].ref & ~leafFlag, ranges[i].first, ranges[i].last, 1);
+					clusters[i].count = ranges[i].last - ranges[i].first + 1;
+				}
+			});
+
+			return buildTop(clusters, 0, clusters.size());
+		}
+
+		// moves the triangle ranges into depth first leaf order
+		void relayout(BvhNode& node, const std::vector<Triangle>& sorted, std::vector<Triangle>& reordered) {
+			if (node.left) {
+				relayout(*node.left, sorted, reordered);
+				relayout(*node.right, sorted, reordered);
+			} else {
+				uint32_t offset = static_cast<uint32_t>(reordered.size());
+				reordered.insert(reordered.end(), sorted.begin() + node.offset, sorted.begin() + node.offset + node.count);
+				node.offset = offset;
+			}
+		}
+
+	public:
+		LbvhBuilder(std::vector<Triangle>& triangles, const BuildParams& params) : triangles(triangles), params(params) {
+			threads = triangles.size() >= params.parallelCutoff ? std::max(1u, params.threadCount) : 1;
+			maxLeafSize = std::max<size_t>(1, params.maxLeafSize);
+			bitsPerAxis = params.mortonBits > 30 ? 21 : 10;
+		}
+
+		std::unique_ptr<BvhNode> build() {
+			if (triangles.empty()) {
+				return std::make_unique<BvhNode>();
+			}
+
+			computeCodes();
+
+			std::vector<Triangle> sorted(triangles.size());
+			for (size_t i=0; i<triangles.size(); ++i) {
+				sorted[i] = triangles[order[i]];
+			}
+
+			if (triangles.size() <= maxLeafSize) {
+				triangles.swap(sorted);
+				return makeNode(0, 0, triangles.size() - 1, 1);
+			}
+
+			uint32_t root = emitHierarchy();
+
+			if (params.lbvhSahClusters <= 1) {
+				triangles.swap(sorted);
+				return makeNode(root, 0, triangles.size() - 1, threads);
+			}
+
+			auto node = buildClustered(root);
+
+			triangles.clear();
+			relayout(*node, sorted, triangles);
+
+			return node;
+		}
+	};
+}
+
+std::unique_ptr<BvhNode> BvhNode::buildLbvh(std::vector<Triangle>& triangles, const BuildParams& params) {
+	return LbvhBuilder(triangles, params).build();
+}
@@ -1,17 +1,115 @@
 #include "renderer.h"
+#include "kernels.h"
+
+#include <cstdlib>
 
 static Renderer p;
 static bool running = true;
 
+static bool parseOption(const std::string& arg, BuildParams& buildParams, unsigned& threadCount, RenderParams& renderParams, bool& occlusionBenchmark, std::string& cacheDirectory,
+	Progress::Mode& progressMode, int& progressInterval) {
+	if (arg.compare(0, 2, "--") != 0) {
+		return false;
+	}
+
+	size_t eq = arg.find('=');
+	std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+	std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+	if (name == "threads") {
+		threadCount = std::max(1, std::stoi(value));
+	} else if (name == "packet-size") {
+		renderParams.packetSize = std::stoi(value);
+	} else if (name == "tile-size") {
+		renderParams.parseTileSize(value);
+	} else if (name == "tile-order") {
+		renderParams.tileOrder = RenderParams::parseTileOrder(value);
+	} else if (name == "kernels") {
+		Kernels::select(value);
+	} else if (name == "benchmark-occlusion") {
+		occlusionBenchmark = true;
+	} else if (name == "batch") {
+		progressMode = Progress::Mode::Off;
+	} else if (name == "progress") {
+		progressMode = Progress::parseMode(value);
+	} else if (name == "progress-interval") {
+		progressInterval = std::max(1, std::stoi(value));
+	} else if (name == "cache") {
+		TreeCache::prepareDirectory(value);
+		cacheDirectory = value;
+	} else if (name == "builder") {
+		buildParams.builder = BuildParams::parseBuilder(value);
+	} else if (name == "traversal-cost") {
+		buildParams.traversalCost = std::stof(value);
+	} else if (name == "intersection-cost") {
+		buildParams.intersectionCost = std::stof(value);
+	} else if (name == "max-leaf-size") {
+		buildParams.maxLeafSize = std::stoul(value);
+	} else if (name == "bin-count") {
+		buildParams.binCount = std::stoi(value);
+	} else if (name == "morton-bits") {
+		buildParams.mortonBits = std::stoi(value);
+	} else if (name == "lbvh-sah-clusters") {
+		buildParams.lbvhSahClusters = std::stoul(value);
+	} else if (name == "sbvh-alpha") {
+		buildParams.sbvhAlpha = std::stof(value);
+	} else if (name == "treelet-passes") {
+		buildParams.treeletPasses = std::stoi(value);
+	} else if (name == "refit-threshold") {
+		buildParams.refitThreshold = std::stof(value);
+	} else if (name == "tree-width") {
+		buildParams.treeWidth = std::stoi(value);
+	} else if (name == "node-bits") {
+		buildParams.nodeBits = std::stoi(value);
+	} else {
+		throw std::runtime_error("unknown option '" + arg + "'!");
+	}
+
+	return true;
+}
+
 int main(int argc, char const *argv[]) {
 	signal(SIGINT, [] (int) { p.killThreads(); running = false; });
-	p.setThreadCount(std::thread::hardware_concurrency());
 
-	if (argc == 1) {
+	BuildParams buildParams;
+	unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+	RenderParams renderParams;
+	bool occlusionBenchmark = false;
+	std::string cacheDirectory;
+	Progress::Mode progressMode = Progress::Mode::Bar;
+	int progressInterval = 250;
+	std::vector<std::string> sceneNames;
+
+	// the command line overrides the environment, both override the cpu detection
+	const char* kernels = std::getenv("RAYTRACER_KERNELS");
+	if (kernels) {
+		Kernels::select(kernels);
+	}
+
+	for (int i=1; i<argc; ++i) {
+		if (!parseOption(argv[i], buildParams, threadCount, renderParams, occlusionBenchmark, cacheDirectory, progressMode, progressInterval)) {
+			sceneNames.push_back(argv[i]);
+		}
+	}
+
+	std::cout << "Using " << Kernels::active->name << " kernels..." << std::endl;
+
+	// every scene and phase runs on these threads
+	ThreadPool pool(threadCount);
+	ThreadPool::global = &pool;
+
+	p.setThreadCount(threadCount);
+	p.setBuildParams(buildParams);
+	p.setRenderParams(renderParams);
+	p.setOcclusionBenchmark(occlusionBenchmark);
+	p.setCacheDirectory(cacheDirectory);
+	p.setProgress(progressMode, std::chrono::milliseconds(progressInterval));
+
+	if (sceneNames.empty()) {
 		p.run("scene");
 	} else {
-		for (int i=1; i<argc && running; ++i) {
-			std::string sceneName = argv[i];
+		for (size_t i=0; i<sceneNames.size() && running; ++i) {
+			std::string sceneName = sceneNames[i];
 			std::string extension = ".txt";
 
 			if (std::equal(extension.rbegin(), extension.rend(), sceneName.rbegin())) {
@@ -27,4 +125,5 @@ int main(int argc, char const *argv[]) {
 		}
 	}
 
+	p.waitForImages();
 }
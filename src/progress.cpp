@@ -0,0 +1,65 @@
+#include "progress.h"
+
+#include <algorithm>
+#include <cstdint>
+
+Progress::Progress(Mode mode, const std::string& label, size_t total, unsigned slots, std::chrono::milliseconds interval)
+	: mode(mode), label(label), total(total), counters(std::max(1u, slots)),
+	interval(interval), start(std::chrono::steady_clock::now()) {
+	if (mode != Mode::Off) {
+		reporter = std::thread(&Progress::reporterLoop, this);
+	}
+}
+
+Progress::~Progress() {
+	if (!reporter.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lg(stopMutex);
+		stopping = true;
+	}
+	stopped.notify_all();
+	reporter.join();
+
+	report(done());
+
+	if (mode == Mode::Bar) {
+		std::cout << std::endl;
+	}
+}
+
+size_t Progress::done() const {
+	size_t sum = 0;
+	for (const Counter& counter : counters) {
+		sum += counter.count.load(std::memory_order_relaxed);
+	}
+
+	return std::min(sum, total);
+}
+
+void Progress::report(size_t done) {
+	double fraction = total ? static_cast<double>(done) / total : 1.0;
+
+	if (mode == Mode::Bar) {
+		std::cout << "\rRender process: " << static_cast<int>(100 * fraction) << "%";
+		std::cout.flush();
+		return;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double rate = seconds > 0 ? done / seconds : 0;
+	double eta = rate > 0 ? (total - done) / rate : 0;
+
+	std::cout << "progress " << label << " percent=" << 100 * fraction << " rays_per_second=" << static_cast<uint64_t>(rate)
+		<< " eta_seconds=" << eta << std::endl;
+}
+
+void Progress::reporterLoop() {
+	std::unique_lock<std::mutex> lock(stopMutex);
+
+	while (!stopped.wait_for(lock, interval, [this] { return stopping; })) {
+		report(done());
+	}
+}
@@ -1,93 +1,35 @@
 #include "ray.h"
 
-bool Ray::intersectTriangle(const Triangle& triangle, HitInfo& hitInfo) const {
-	glm::vec3 v0v1 = triangle.v1->pos - triangle.v0->pos;
-	glm::vec3 v0v2 = triangle.v2->pos - triangle.v0->pos;
-	glm::vec3 pvec = glm::cross(dir, v0v2);
-	float det = glm::dot(v0v1, pvec);
+#include "kernels.h"
 
-	if (det > 0) return false; //culling
-
-	float invDet = 1 / det;
-
-	glm::vec3 tvec = orig - triangle.v0->pos;
-	float u = glm::dot(tvec, pvec) * invDet;
-	if (u < 0 || u > 1) return false;
-
-	glm::vec3 qvec = glm::cross(tvec, v0v1);
-	float v = glm::dot(dir, qvec) * invDet;
-	if (v < 0 || u + v > 1.001f) return false;
-
-	float t = glm::dot(v0v2, qvec) * invDet;
-
-	if (t < hitInfo.t) {
-		hitInfo.t = t;
-		hitInfo.u = u;
-		hitInfo.v = v;
-		hitInfo.triangle = &triangle;
-	}
-
-	return true;
+bool Ray::intersectFlatTree(const FlatTree& tree, HitInfo& hitInfo) const {
+	return Kernels::active->flatTree.intersect(*this, tree, hitInfo);
 }
 
-bool Ray::intersectKdNode(KdNode* node, HitInfo& hitInfo) const {
-	if (intersectBoundingBox(node->bbox)) {
-		if (node->left || node->right) {
-			intersectKdNode(node->left.get(), hitInfo);
-			intersectKdNode(node->right.get(), hitInfo);
-		} else {
-			intersectTriangle(node->triangle, hitInfo);
-		}
-	}
-
-	return hitInfo;
+bool Ray::occluded(const FlatTree& tree, float tmax) const {
+	return Kernels::active->flatTree.occluded(*this, tree, tmax);
 }
 
-bool Ray::intersectBoundingBox(const BoundingBox& bbox) const {
-	float tmin = (bbox.min.x - orig.x) / dir.x;
-	float tmax = (bbox.max.x - orig.x) / dir.x;
-
-	if (tmin > tmax) {
-		std::swap(tmin, tmax);
-	}
-
-	float tymin = (bbox.min.y - orig.y) / dir.y;
-	float tymax = (bbox.max.y - orig.y) / dir.y;
-
-	if (tymin > tymax) {
-		std::swap(tymin, tymax);
-	}
-
-	if ((tmin > tymax) || (tymin > tmax)) {
-		return false;
-	}
-
-	if (tymin > tmin) {
-		tmin = tymin;
-	}
-
-	if (tymax < tmax) {
-		tmax = tymax;
-	}
-
-	float tzmin = (bbox.min.z - orig.z) / dir.z;
-	float tzmax = (bbox.max.z - orig.z) / dir.z;
-
-	if (tzmin > tzmax) {
-		std::swap(tzmin, tzmax);
-	}
-
-	if ((tmin > tzmax) || (tzmin > tmax)) {
-		return false;
-	}
-
-	if (tzmin > tmin) {
-		tmin = tzmin;
-	}
-
-	if (tzmax < tmax) {
-		tmax = tzmax;
-	}
+template<int Width, typename Bound>
+bool Ray::intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo& hitInfo) const {
+	return Kernels::active->wideTree<Width, Bound>().intersect(*this, tree, hitInfo);
+}
 
-	return true;
+template<int Width, typename Bound>
+bool Ray::occluded(const WideTree<Width, Bound>& tree, float tmax) const {
+	return Kernels::active->wideTree<Width, Bound>().occluded(*this, tree, tmax);
 }
+
+template bool Ray::intersectWideTree(const WideTree<4>& tree, HitInfo& hitInfo) const;
+template bool Ray::intersectWideTree(const WideTree<8>& tree, HitInfo& hitInfo) const;
+template bool Ray::intersectWideTree(const WideTree<4, uint8_t>& tree, HitInfo& hitInfo) const;
+template bool Ray::intersectWideTree(const WideTree<4, uint16_t>& tree, HitInfo& hitInfo) const;
+template bool Ray::intersectWideTree(const WideTree<8, uint8_t>& tree, HitInfo& hitInfo) const;
+template bool Ray::intersectWideTree(const WideTree<8, uint16_t>& tree, HitInfo& hitInfo) const;
+
+template bool Ray::occluded(const WideTree<4>& tree, float tmax) const;
+template bool Ray::occluded(const WideTree<8>& tree, float tmax) const;
+template bool Ray::occluded(const WideTree<4, uint8_t>& tree, float tmax) const;
+template bool Ray::occluded(const WideTree<4, uint16_t>& tree, float tmax) const;
+template bool Ray::occluded(const WideTree<8, uint8_t>& tree, float tmax) const;
+template bool Ray::occluded(const WideTree<8, uint16_t>& tree, float tmax) const;
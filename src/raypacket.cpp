@@ -0,0 +1,60 @@
+#include "raypacket.h"
+
+#include "kernels.h"
+
+template<int Size>
+void RayPacket<Size>::setRay(int i, const glm::vec3& rayDir) {
+	for (int axis=0; axis<3; ++axis) {
+		dir[axis][i] = rayDir[axis];
+		invDir[axis][i] = 1.0f / rayDir[axis];
+	}
+}
+
+template<int Size>
+bool RayPacket<Size>::coherent() const {
+	for (int axis=0; axis<3; ++axis) {
+		for (int i=1; i<Size; ++i) {
+			if ((dir[axis][i] < 0) != (dir[axis][0] < 0)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+template<int Size>
+bool RayPacket<Size>::intersectFlatTree(const FlatTree& tree, HitInfo* hitInfos) {
+	return Kernels::active->flatTree.intersectPacket(*this, tree, hitInfos);
+}
+
+template<int Size>
+template<int Width, typename Bound>
+bool RayPacket<Size>::intersectWideTree(const WideTree<Width, Bound>& tree, HitInfo* hitInfos) {
+	return Kernels::active->wideTree<Width, Bound>().intersectPacket(*this, tree, hitInfos);
+}
+
+template struct RayPacket<4>;
+template struct RayPacket<16>;
+template struct RayPacket<64>;
+
+template bool RayPacket<4>::intersectWideTree(const WideTree<4>& tree, HitInfo* hitInfos);
+template bool RayPacket<4>::intersectWideTree(const WideTree<8>& tree, HitInfo* hitInfos);
+template bool RayPacket<4>::intersectWideTree(const WideTree<4, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<4>::intersectWideTree(const WideTree<4, uint16_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<4>::intersectWideTree(const WideTree<8, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<4>::intersectWideTree(const WideTree<8, uint16_t>& tree, HitInfo* hitInfos);
+
+template bool RayPacket<16>::intersectWideTree(const WideTree<4>& tree, HitInfo* hitInfos);
+template bool RayPacket<16>::intersectWideTree(const WideTree<8>& tree, HitInfo* hitInfos);
+template bool RayPacket<16>::intersectWideTree(const WideTree<4, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<16>::intersectWideTree(const WideTree<4, uint16_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<16>::intersectWideTree(const WideTree<8, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<16>::intersectWideTree(const WideTree<8, uint16_t>& tree, HitInfo* hitInfos);
+
+template bool RayPacket<64>::intersectWideTree(const WideTree<4>& tree, HitInfo* hitInfos);
+template bool RayPacket<64>::intersectWideTree(const WideTree<8>& tree, HitInfo* hitInfos);
+template bool RayPacket<64>::intersectWideTree(const WideTree<4, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<64>::intersectWideTree(const WideTree<4, uint16_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<64>::intersectWideTree(const WideTree<8, uint8_t>& tree, HitInfo* hitInfos);
+template bool RayPacket<64>::intersectWideTree(const WideTree<8, uint16_t>& tree, HitInfo* hitInfos);
@@ -1,6 +1,14 @@
 #include "renderer.h"
 
-#include <ctime>
+#include <chrono>
+#include <sstream>
+
+namespace {
+	// wall time between two steady clock readings, all threads of a phase count once
+	long long milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+	}
+}
 
 void Renderer::loadModel(const std::string& modelName) {
 	vertices.resize(0);
@@ -14,26 +22,41 @@ void Renderer::loadModel(const std::string& modelName) {
 		throw std::runtime_error(err);
 	}
 
+	size_t vertexCount = 0;
+	for (const auto& shape : shapes) {
+		vertexCount += shape.mesh.indices.size();
+	}
+	vertices.resize(vertexCount);
+
+	// the text is parsed on one thread, turning the indices into vertices is split over the pool
+	size_t first = 0;
 	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
-			Vertex vertex {};
-
-			vertex.pos = {
-				attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 0],
-				attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 1],
-				attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 2]
-			};
-
-			if (index.normal_index != -1) {
-				vertex.normal = {
-					attrib.normals[3 * static_cast<size_t>(index.normal_index) + 0],
-					attrib.normals[3 * static_cast<size_t>(index.normal_index) + 1],
-					attrib.normals[3 * static_cast<size_t>(index.normal_index) + 2]
+		const auto& indices = shape.mesh.indices;
+
+		parallelFor(0, indices.size(), indices.size() >= buildParams.parallelCutoff ? threadCount : 1, [&] (size_t begin, size_t end, size_t) {
+			for (size_t i=begin; i<end; ++i) {
+				const auto& index = indices[i];
+				Vertex vertex {};
+
+				vertex.pos = {
+					attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 0],
+					attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 1],
+					attrib.vertices[3 * static_cast<size_t>(index.vertex_index) + 2]
 				};
+
+				if (index.normal_index != -1) {
+					vertex.normal = {
+						attrib.normals[3 * static_cast<size_t>(index.normal_index) + 0],
+						attrib.normals[3 * static_cast<size_t>(index.normal_index) + 1],
+						attrib.normals[3 * static_cast<size_t>(index.normal_index) + 2]
+					};
+				}
+
+				vertices[first + i] = vertex;
 			}
+		});
 
-			vertices.push_back(vertex);
-		}
+		first += indices.size();
 	}
 
 	#ifdef BARYCENTER_INTERPOLATION
@@ -71,10 +94,7 @@ void Renderer::loadScene(const std::string& sceneFileName) {
 			model = glm::translate(model, glm::vec3{.5f * width, -.5f * height, 0});
 			imageData.resize(pixelCount);
 		} else if (name == "model") {
-			std::string modelName;
-			sceneFile >> modelName;
-
-			loadModel("models/" + modelName + ".obj");
+			sceneFile >> sceneModelName;
 		} else if (name == "scale") {
 			float scale;
 			sceneFile >> scale;
@@ -124,23 +144,99 @@ void Renderer::loadScene(const std::string& sceneFileName) {
 				sceneFile >> lights[i].pos.x >> lights[i].pos.y >> lights[i].pos.z;
 				sceneFile >> lights[i].color.x >> lights[i].color.y >> lights[i].color.z;
 			}
+		} else if (name == "builder") {
+			std::string builderName;
+			sceneFile >> builderName;
+
+			buildParams.builder = BuildParams::parseBuilder(builderName);
+		} else if (name == "traversal_cost") {
+			sceneFile >> buildParams.traversalCost;
+		} else if (name == "intersection_cost") {
+			sceneFile >> buildParams.intersectionCost;
+		} else if (name == "max_leaf_size") {
+			sceneFile >> buildParams.maxLeafSize;
+		} else if (name == "bin_count") {
+			sceneFile >> buildParams.binCount;
+		} else if (name == "morton_bits") {
+			sceneFile >> buildParams.mortonBits;
+		} else if (name == "lbvh_sah_clusters") {
+			sceneFile >> buildParams.lbvhSahClusters;
+		} else if (name == "sbvh_alpha") {
+			sceneFile >> buildParams.sbvhAlpha;
+		} else if (name == "treelet_passes") {
+			sceneFile >> buildParams.treeletPasses;
+		} else if (name == "refit_threshold") {
+			sceneFile >> buildParams.refitThreshold;
+		} else if (name == "tree_width") {
+			sceneFile >> buildParams.treeWidth;
+		} else if (name == "node_bits") {
+			sceneFile >> buildParams.nodeBits;
+		} else if (name == "packet_size") {
+			sceneFile >> renderParams.packetSize;
+		} else if (name == "tile_size") {
+			std::string tileSize;
+			sceneFile >> tileSize;
+
+			renderParams.parseTileSize(tileSize);
+		} else if (name == "tile_order") {
+			std::string tileOrder;
+			sceneFile >> tileOrder;
+
+			renderParams.tileOrder = RenderParams::parseTileOrder(tileOrder);
 		}
 	}
 }
 
-void Renderer::applyTransformation() {
-	view = glm::scale(view, glm::vec3{1, -1, 1});
+void Renderer::loadSceneModel() {
+	// consecutive scenes of the same model only need to transform it again
+	if (!sceneModelName.empty() && sceneModelName != modelName) {
+		modelName.clear();
+		loadModel("models/" + sceneModelName + ".obj");
+		modelName = sceneModelName;
+		modelChanged = true;
+	}
+}
+
+bool Renderer::loadCachedTree() {
+	cachedWideTree = TreeCache::WideSection();
+
+	if (cacheDirectory.empty() || sceneModelName.empty()) {
+		cacheFileName.clear();
+		return false;
+	}
+
+	cacheKey = TreeCache::key(TreeCache::hashFile("models/" + sceneModelName + ".obj"), view * model, buildParams);
+
+	std::ostringstream fileName;
+	fileName << cacheDirectory << "/" << sceneModelName << "-" << std::hex << cacheKey << ".bvh";
+	cacheFileName = fileName.str();
+
+	if (!TreeCache::load(cacheFileName, cacheKey, tree, cachedWideTree, treeBuildCost)) {
+		return false;
+	}
+
+	// the tree references the cached vertices, it cannot be refitted to the loaded model
+	treeBuilt = false;
+
+	std::cout << "Loaded " << tree.nodes.size() << " nodes from " << cacheFileName << "..." << std::endl;
+	return true;
+}
 
+void Renderer::applyTransformation(bool transformVertices) {
 	glm::mat4 mv = view * model;
 	glm::mat3 normal_mv = glm::transpose(glm::inverse(glm::mat3{mv}));
 
 	transformed_vertices.resize(vertices.size());
-	for (size_t i=0; i<vertices.size(); ++i) {
-		const Vertex& v = vertices[i];
-		Vertex& transformed_v = transformed_vertices[i];
-
-		transformed_v.pos = mv * glm::vec4{v.pos, 1.0f};
-		transformed_v.normal = glm::normalize(normal_mv * v.normal);
+	if (transformVertices) {
+		parallelFor(0, vertices.size(), vertices.size() >= buildParams.parallelCutoff ? threadCount : 1, [&] (size_t begin, size_t end, size_t) {
+			for (size_t i=begin; i<end; ++i) {
+				const Vertex& v = vertices[i];
+				Vertex& transformed_v = transformed_vertices[i];
+
+				transformed_v.pos = mv * glm::vec4{v.pos, 1.0f};
+				transformed_v.normal = glm::normalize(normal_mv * v.normal);
+			}
+		});
 	}
 
 	transformed_lights.resize(lights.size());
@@ -154,23 +250,334 @@ void Renderer::applyTransformation() {
 }
 
 void Renderer::buildKdTree() {
-	std::vector<Triangle> triangles(vertices.size() / 3);
+	size_t triangleCount = vertices.size() / 3;
+	std::vector<Triangle> triangles(triangleCount);
 
 	for (size_t i=0, j=0; i<vertices.size(); i += 3) {
 		triangles[j++] = { &transformed_vertices[i], &transformed_vertices[i + 1], &transformed_vertices[i + 2] };
 	}
 
-	kdTree = std::make_unique<KdNode>(triangles.begin(), triangles.end());
+	ArrayView<const Vertex> vertexView { transformed_vertices.data(), transformed_vertices.size() };
+
+	if (buildParams.buildsBvh()) {
+		auto root = BvhNode::build(triangles, buildParams);
+		optimizeTree(*root);
+		tree = FlatTree::flatten(*root, triangles, vertexView);
+	} else {
+		auto root = KdNode::build(triangles, buildParams);
+		optimizeTree(*root);
+		tree = FlatTree::flatten(*root, triangles, vertexView);
+	}
+
+	treeBuilt = true;
+	treeBuildCost = tree.sahCost(buildParams);
+	treeBuildParams = buildParams;
+
+	std::cout << tree.nodes.size() << " nodes using " << tree.memoryUsage() / 1024 << " KiB..." << std::endl;
+
+	if (tree.triangles.size() != triangleCount) {
+		std::cout << tree.triangles.size() << " triangle references, " << 100.0 * tree.triangles.size() / triangleCount - 100 << "% more than triangles..." << std::endl;
+	}
+}
+
+bool Renderer::refitKdTree() {
+	tree.refit();
+
+	float cost = tree.sahCost(buildParams);
+	if (cost > treeBuildCost * buildParams.refitThreshold) {
+		std::cout << "Refitting raised the SAH cost from " << treeBuildCost << " to " << cost << ", rebuilding..." << std::endl;
+		return false;
+	}
+
+	std::cout << "Refitted the previous KdTree, SAH cost went from " << treeBuildCost << " to " << cost << "..." << std::endl;
+	return true;
+}
+
+template<typename Node>
+void Renderer::optimizeTree(Node& root) {
+	if (buildParams.treeletPasses <= 0) {
+		return;
+	}
+
+	float initialCost = sahCost(root, buildParams);
+	float optimizedCost = optimizeTreelets(root, buildParams);
+
+	std::cout << "Treelet restructuring lowered the SAH cost from " << initialCost << " to " << optimizedCost << "..." << std::endl;
+}
+
+// calls function with the wide tree selected by the tree width and node bits
+template<typename Function>
+bool Renderer::visitWideTree(Function function) {
+	bool wide8 = buildParams.treeWidth == 8;
+
+	switch (buildParams.nodeBits) {
+		case 8: return wide8 ? function(tree8x8) : function(tree4x8);
+		case 16: return wide8 ? function(tree8x16) : function(tree4x16);
+		default: return wide8 ? function(tree8) : function(tree4);
+	}
+}
+
+void Renderer::collapseTree() {
+	tree4 = {};
+	tree8 = {};
+	tree4x8 = {};
+	tree4x16 = {};
+	tree8x8 = {};
+	tree8x16 = {};
+
+	if (buildParams.treeWidth == 2) {
+		// only wide nodes have quantized bounds, the binary tree always keeps floats
+		if (buildParams.nodeBits != 32) {
+			std::cerr << "Warning: node_bits " << buildParams.nodeBits << " is ignored with tree_width 2" << std::endl;
+		}
+		return;
+	} else if (buildParams.treeWidth != 4 && buildParams.treeWidth != 8) {
+		throw std::runtime_error("tree width must be 2, 4 or 8!");
+	} else if (buildParams.nodeBits != 8 && buildParams.nodeBits != 16 && buildParams.nodeBits != 32) {
+		throw std::runtime_error("node bits must be 8, 16 or 32!");
+	}
+
+	visitWideTree([this] (auto& wide) {
+		if (TreeCache::map(cachedWideTree, tree, wide)) {
+			std::cout << "Loaded " << wide.nodes.size() << " nodes of width " << buildParams.treeWidth << " and " << buildParams.nodeBits
+				<< " bit bounds from the cache..." << std::endl;
+			return true;
+		}
+
+		wide = std::decay_t<decltype(wide)>::collapse(tree);
+		std::cout << "Collapsed into " << wide.nodes.size() << " nodes of width " << buildParams.treeWidth << " and " << buildParams.nodeBits
+			<< " bit bounds using " << wide.memoryUsage() / 1024 << " KiB..." << std::endl;
+		return true;
+	});
+}
+
+bool Renderer::traceRay(const Ray& ray, HitInfo& hitInfo) {
+	if (buildParams.treeWidth == 2) {
+		return ray.intersectFlatTree(tree, hitInfo);
+	}
+
+	return visitWideTree([&] (const auto& wide) { return ray.intersectWideTree(wide, hitInfo); });
+}
+
+bool Renderer::occluded(const Ray& ray, float tmax) {
+	if (buildParams.treeWidth == 2) {
+		return ray.occluded(tree, tmax);
+	}
+
+	return visitWideTree([&] (const auto& wide) { return ray.occluded(wide, tmax); });
+}
+
+void Renderer::benchmarkOcclusion() {
+	// shadow rays from every visible point towards every light, started slightly off the surface
+	constexpr float shadowBias = 1e-2f;
+
+	std::vector<Ray> rays;
+	std::vector<float> distances;
+
+	for (uint32_t y=0; y<height; ++y) {
+		for (uint32_t x=0; x<width; ++x) {
+			glm::vec3 dir = glm::normalize(glm::vec3{x, y, 0} - camera);
+
+			HitInfo hitInfo;
+			if (!traceRay({ camera, dir }, hitInfo)) continue;
+
+			glm::vec3 hitPoint = camera + dir * hitInfo.t;
+
+			for (const Light& light : transformed_lights) {
+				glm::vec3 toLight = light.pos - hitPoint;
+				float distance = glm::length(toLight);
+
+				rays.emplace_back(hitPoint + toLight * (shadowBias / distance), toLight / distance);
+				distances.push_back(distance - shadowBias);
+			}
+		}
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	size_t occludedCount = 0;
+	for (size_t i=0; i<rays.size(); ++i) {
+		occludedCount += occluded(rays[i], distances[i]);
+	}
+	auto occlusionTime = std::chrono::steady_clock::now();
+
+	size_t hitCount = 0;
+	for (size_t i=0; i<rays.size(); ++i) {
+		HitInfo hitInfo;
+		hitCount += traceRay(rays[i], hitInfo) && hitInfo.t > 0 && hitInfo.t < distances[i];
+	}
+	auto closestTime = std::chrono::steady_clock::now();
+
+	std::cout << "Traced " << rays.size() << " shadow rays, " << occludedCount << " occluded (" << hitCount << " front facing hits)..." << std::endl;
+	std::cout << "Occlusion queries took " << milliseconds(startTime, occlusionTime) << " milliseconds..." << std::endl;
+	std::cout << "Closest hit queries took " << milliseconds(occlusionTime, closestTime) << " milliseconds..." << std::endl;
 }
 
 uint32_t Renderer::calculatePixel(uint32_t x, uint32_t y) {
 	glm::vec3 dir = glm::normalize(glm::vec3{x, y, 0} - camera);
-	glm::vec3 color { 0.1, 0.1, 0.1 };
 	Ray ray { camera, dir };
 
 	HitInfo hitInfo;
-	if (ray.intersectKdNode(kdTree.get(), hitInfo)) {
-		glm::vec3 normal = hitInfo.triangle->v0->normal * (1 - hitInfo.u - hitInfo.v) + hitInfo.triangle->v1->normal * hitInfo.u + hitInfo.triangle->v2->normal * hitInfo.v;
+	traceRay(ray, hitInfo);
+
+	return shadePixel(dir, hitInfo);
+}
+
+template<int Side>
+void Renderer::calculatePacket(uint32_t x0, uint32_t y0, uint32_t* pixels, size_t stride) {
+	constexpr int size = Side * Side;
+
+	RayPacket<size> packet;
+	packet.orig = camera;
+	glm::vec3 dirs[size];
+
+	// packets past the image border repeat its last row and column
+	for (int i=0; i<size; ++i) {
+		uint32_t x = std::min(x0 + i % Side, width - 1);
+		uint32_t y = std::min(y0 + i / Side, height - 1);
+
+		dirs[i] = glm::normalize(glm::vec3{x, y, 0} - camera);
+		packet.setRay(i, dirs[i]);
+	}
+
+	HitInfo hitInfos[size];
+
+	// rays on both sides of an axis disagree on traversal order, those are traced one by one
+	if (!packet.coherent()) {
+		for (int i=0; i<size; ++i) {
+			traceRay({ camera, dirs[i] }, hitInfos[i]);
+		}
+	} else if (buildParams.treeWidth == 2 || size < 64) {
+		// packets smaller than 8x8 are faster through the binary tree, masking their few rays through the
+		// wide nodes costs more than the nodes it saves
+		packet.intersectFlatTree(tree, hitInfos);
+	} else {
+		visitWideTree([&] (const auto& wide) { return packet.intersectWideTree(wide, hitInfos); });
+	}
+
+	for (int i=0; i<size; ++i) {
+		if (x0 + i % Side < width && y0 + i / Side < height) {
+			pixels[(i / Side) * stride + i % Side] = shadePixel(dirs[i], hitInfos[i]);
+		}
+	}
+}
+
+size_t Renderer::calculateStrip(size_t tileIndex, uint32_t strip, std::vector<uint32_t>& pixels) {
+	uint32_t tileWidth = renderParams.tileWidth, tileHeight = renderParams.tileHeight;
+	uint32_t side = static_cast<uint32_t>(renderParams.packetSize);
+	uint32_t tilesPerRow = (width + tileWidth - 1) / tileWidth;
+	uint32_t x0 = static_cast<uint32_t>(tileIndex % tilesPerRow) * tileWidth;
+	uint32_t y0 = static_cast<uint32_t>(tileIndex / tilesPerRow) * tileHeight + strip * side;
+
+	// strips of the last tile row may lie below the image
+	if (y0 >= height) {
+		return 0;
+	}
+
+	uint32_t w = std::min(tileWidth, width - x0), h = std::min(side, height - y0);
+
+	pixels.resize(static_cast<size_t>(tileWidth) * side);
+
+	// one packet high, the row of packets of a tile
+	for (uint32_t x=0; x<w; x+=side) {
+		switch (side) {
+			case 2: calculatePacket<2>(x0 + x, y0, &pixels[x], tileWidth); break;
+			case 4: calculatePacket<4>(x0 + x, y0, &pixels[x], tileWidth); break;
+			case 8: calculatePacket<8>(x0 + x, y0, &pixels[x], tileWidth); break;
+			default: pixels[x] = calculatePixel(x0 + x, y0);
+		}
+	}
+
+	// the finished rows go out at once, only tile borders share cache lines with other threads
+	for (uint32_t y=0; y<h; ++y) {
+		const uint32_t* row = &pixels[static_cast<size_t>(y) * tileWidth];
+		std::copy(row, row + w, &imageData[static_cast<size_t>(y0 + y) * width + x0]);
+	}
+
+	return static_cast<size_t>(w) * h;
+}
+
+size_t Renderer::tileCount() {
+	size_t tileWidth = renderParams.tileWidth, tileHeight = renderParams.tileHeight;
+	return ((width + tileWidth - 1) / tileWidth) * ((height + tileHeight - 1) / tileHeight);
+}
+
+namespace {
+	// every other bit of v, starting with the lowest
+	inline uint32_t compactBits(uint32_t v) {
+		v &= 0x55555555;
+		v = (v | v >> 1) & 0x33333333;
+		v = (v | v >> 2) & 0x0F0F0F0F;
+		v = (v | v >> 4) & 0x00FF00FF;
+		v = (v | v >> 8) & 0x0000FFFF;
+
+		return v;
+	}
+
+	// the cell at distance d along the hilbert curve through a side x side grid, side a power of two
+	inline void hilbertCell(uint32_t side, uint32_t d, uint32_t& x, uint32_t& y) {
+		x = y = 0;
+
+		for (uint32_t s=1; s<side; s*=2, d/=4) {
+			uint32_t rx = 1 & (d / 2);
+			uint32_t ry = 1 & (d ^ rx);
+
+			// quadrants on the left are mirrored and transposed so that the curve stays connected
+			if (ry == 0) {
+				if (rx == 1) {
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+
+			x += s * rx;
+			y += s * ry;
+		}
+	}
+}
+
+void Renderer::orderTiles() {
+	uint32_t tilesPerRow = (width + renderParams.tileWidth - 1) / renderParams.tileWidth;
+	uint32_t tilesPerColumn = (height + renderParams.tileHeight - 1) / renderParams.tileHeight;
+
+	tileSequence.resize(0);
+	tileSequence.reserve(tileCount());
+
+	if (renderParams.tileOrder == RenderParams::TileOrder::Scanline) {
+		for (uint32_t i=0; i<tilesPerRow * tilesPerColumn; ++i) {
+			tileSequence.push_back(i);
+		}
+		return;
+	}
+
+	// the curves cover the smallest power of two square holding every tile, cells past the image are skipped
+	uint32_t side = 1;
+	while (side < std::max(tilesPerRow, tilesPerColumn)) {
+		side *= 2;
+	}
+
+	for (uint32_t d=0; d<side * side; ++d) {
+		uint32_t x, y;
+
+		if (renderParams.tileOrder == RenderParams::TileOrder::Morton) {
+			x = compactBits(d);
+			y = compactBits(d >> 1);
+		} else {
+			hilbertCell(side, d, x, y);
+		}
+
+		if (x < tilesPerRow && y < tilesPerColumn) {
+			tileSequence.push_back(y * tilesPerRow + x);
+		}
+	}
+}
+
+uint32_t Renderer::shadePixel(const glm::vec3& dir, const HitInfo& hitInfo) {
+	glm::vec3 color { 0.1, 0.1, 0.1 };
+
+	if (hitInfo.t < std::numeric_limits<float>::max()) {
+		glm::vec3 normal = hitInfo.triangle.v0->normal * (1 - hitInfo.u - hitInfo.v) + hitInfo.triangle.v1->normal * hitInfo.u + hitInfo.triangle.v2->normal * hitInfo.v;
 		glm::vec3 hitPoint = camera + dir * hitInfo.t;
 		glm::vec3 diffuse {}, specular {};
 
@@ -194,81 +601,159 @@ uint32_t Renderer::calculatePixel(uint32_t x, uint32_t y) {
 	return colorInt.r | (colorInt.g << 8) | (colorInt.b << 16) | (0xFFu << 24);
 }
 
-void Renderer::workerFunction() {
-	while (true) {
-		size_t currentIndex = drawingIndex.fetch_add(1);
+void Renderer::workerFunction(WorkQueue& queue, Progress& progress, unsigned slot) {
+	uint32_t strips = renderParams.tileHeight / static_cast<uint32_t>(renderParams.packetSize);
+	std::vector<uint32_t> pixels;
 
-		if (currentIndex % (pixelCount / 100) == 0) {
-			std::lock_guard<std::mutex> lg(coutMutex);
-			std::cout << "\rRender process: " << 100 * currentIndex / pixelCount << "%";
-			std::cout.flush();
-		}
-
-		if (currentIndex >= pixelCount) {
-			break;
-		}
-
-		imageData[currentIndex] = calculatePixel(currentIndex % width, static_cast<uint32_t>(currentIndex / width));
+	// strips of the same tile follow each other, a thief takes the bottom half of a tile in progress
+	size_t item;
+	while (!stopRendering && queue.next(slot, item)) {
+		progress.add(slot, calculateStrip(tileSequence[item / strips], static_cast<uint32_t>(item % strips), pixels));
 	}
 }
 
-void Renderer::spawnWorkers() {
-	std::cout << "Spawning " << threadCount - 1 << " extra workers..." << std::endl;
+void Renderer::writeImage(const std::string& sceneName) {
+	// encoded on the pool while the next scene loads, from a copy the next scene cannot overwrite
+	auto image = std::make_shared<std::vector<uint32_t>>(imageData);
+	std::string fileName = "images/" + sceneName + ".bmp";
+	int32_t imageWidth = static_cast<int32_t>(width), imageHeight = static_cast<int32_t>(height);
+
+	auto write = [image, fileName, imageWidth, imageHeight] {
+		stbi_write_bmp(fileName.c_str(), imageWidth, imageHeight, 4, image->data());
+	};
 
-	workers.resize(0);
-	for (size_t i=1; i<threadCount; ++i) {
-		workers.emplace_back(&Renderer::workerFunction, this);
+	if (ThreadPool::global) {
+		ThreadPool::global->submit(imageWrites, write);
+	} else {
+		write();
 	}
 }
 
-void Renderer::joinWorkers() {
-	for (std::thread& t : workers) {
-		t.join();
+void Renderer::waitForImages() {
+	if (ThreadPool::global) {
+		ThreadPool::global->wait(imageWrites);
 	}
 }
 
 void Renderer::run(const std::string& sceneName) {
-	clock_t startTime = clock();
+	auto startTime = std::chrono::steady_clock::now();
 	std::cout << "Rendering " << sceneName << "..." << std::endl;
 
 	model = glm::mat4(1);
-	view = glm::mat4(1);
+	view = glm::scale(glm::mat4(1), glm::vec3{1, -1, 1});
+	buildParams = defaultBuildParams;
+	buildParams.threadCount = threadCount;
+	renderParams = defaultRenderParams;
+	sceneModelName.clear();
+	modelChanged = false;
 
 	loadScene("scenes/" + sceneName + ".txt");
-	clock_t loadTime = clock();
 
-	std::cout << vertices.size() / 3 << " triangles..." << std::endl;
+	int side = renderParams.packetSize;
+	if (side != 1 && side != 2 && side != 4 && side != 8) {
+		throw std::runtime_error("packet size must be 1, 2, 4 or 8!");
+	}
+
+	// packets never straddle two tiles
+	renderParams.tileWidth = (renderParams.tileWidth + side - 1) / side * side;
+	renderParams.tileHeight = (renderParams.tileHeight + side - 1) / side * side;
+
+	bool cached = loadCachedTree();
+	if (!cached) {
+		loadSceneModel();
+	}
+	auto loadTime = std::chrono::steady_clock::now();
+
+	std::cout << (cached ? tree.vertices.size() : vertices.size()) / 3 << " triangles..." << std::endl;
+
+	applyTransformation(!cached);
+	auto transformationTime = std::chrono::steady_clock::now();
+
+	bool refitted = false;
+	if (!cached) {
+		bool canRefit = treeBuilt && !modelChanged && buildParams.canRefit() && buildParams.buildsSameTree(treeBuildParams);
+		refitted = canRefit && refitKdTree();
+
+		if (!refitted) {
+			std::cout << "Building KdTree (" << BuildParams::builderName(buildParams.builder) << ")..." << std::endl;
+			buildKdTree();
+		}
+	}
 
-	applyTransformation();
-	clock_t transformationTime = clock();
+	collapseTree();
 
-	std::cout << "Building KdTree..." << std::endl;
-	buildKdTree();
-	clock_t buildTime = clock();
+	// a cache that cannot be written only costs the next run its build. A refitted tree is never saved,
+	// it is worse than what its key promises and the next run would not refit it any further
+	if (!cached && !refitted && !cacheFileName.empty()) {
+		TreeCache::WideSection wideSection;
+		if (buildParams.treeWidth != 2) {
+			visitWideTree([&] (const auto& wide) { wideSection = TreeCache::section(wide); return true; });
+		}
 
-	drawingIndex = 0;
+		try {
+			TreeCache::save(cacheFileName, cacheKey, tree, wideSection, treeBuildCost);
+		} catch (const std::runtime_error& error) {
+			std::cerr << "Warning: tree not cached, " << error.what() << std::endl;
+		}
+	}
+	auto buildTime = std::chrono::steady_clock::now();
 
-	spawnWorkers();
-	workerFunction();
-	joinWorkers();
-	clock_t rayTime = clock();
+	orderTiles();
+	stopRendering = false;
 
-	std::cout << std::endl << std::endl;
+	// every thread of the pool claims tiles until none are left
+	{
+		Progress progress(progressMode, sceneName, pixelCount, threadCount, progressInterval);
+		WorkQueue queue(tileSequence.size() * (renderParams.tileHeight / static_cast<uint32_t>(renderParams.packetSize)), threadCount);
 
-	stbi_write_bmp(("images/" + sceneName + ".bmp").c_str(), static_cast<int32_t>(width), static_cast<int32_t>(height), 4, imageData.data());
-	clock_t endTime = clock();
+		parallelFor(0, threadCount, threadCount, [&] (size_t, size_t, size_t slot) {
+			workerFunction(queue, progress, static_cast<unsigned>(slot));
+		});
+	}
+	auto rayTime = std::chrono::steady_clock::now();
+
+	std::cout << std::endl;
+
+	writeImage(sceneName);
+	auto endTime = std::chrono::steady_clock::now();
 
-	std::cout << "Scene loading took " << (loadTime - startTime) << " milliseconds..." << std::endl;
-	std::cout << "Transformations took " << (transformationTime - loadTime) << " milliseconds..." << std::endl;
-	std::cout << "KdTree building took " << (buildTime - transformationTime) << " milliseconds..." << std::endl;
-	std::cout << "RayTracing took " << (rayTime - buildTime) << " milliseconds..." << std::endl;
-	std::cout << "Total time was " << (endTime - startTime) << " milliseconds..." << std::endl;
+	std::cout << "Scene loading took " << milliseconds(startTime, loadTime) << " milliseconds..." << std::endl;
+	std::cout << "Transformations took " << milliseconds(loadTime, transformationTime) << " milliseconds..." << std::endl;
+	std::cout << "KdTree building took " << milliseconds(transformationTime, buildTime) << " milliseconds..." << std::endl;
+	std::cout << "RayTracing took " << milliseconds(buildTime, rayTime) << " milliseconds (" << renderParams.tileWidth << "x" << renderParams.tileHeight << " tiles in "
+		<< RenderParams::tileOrderName(renderParams.tileOrder) << " order)..." << std::endl;
+	std::cout << "Total time was " << milliseconds(startTime, endTime) << " milliseconds..." << std::endl;
+
+	if (occlusionBenchmark) {
+		benchmarkOcclusion();
+	}
 }
 
 void Renderer::killThreads() {
-	drawingIndex = pixelCount;
+	stopRendering = true;
 }
 
 void Renderer::setThreadCount(unsigned threadCount) {
 	this->threadCount = threadCount;
 }
+
+void Renderer::setBuildParams(const BuildParams& buildParams) {
+	defaultBuildParams = buildParams;
+}
+
+void Renderer::setRenderParams(const RenderParams& renderParams) {
+	defaultRenderParams = renderParams;
+}
+
+void Renderer::setOcclusionBenchmark(bool occlusionBenchmark) {
+	this->occlusionBenchmark = occlusionBenchmark;
+}
+
+void Renderer::setCacheDirectory(const std::string& cacheDirectory) {
+	this->cacheDirectory = cacheDirectory;
+}
+
+void Renderer::setProgress(Progress::Mode progressMode, std::chrono::milliseconds progressInterval) {
+	this->progressMode = progressMode;
+	this->progressInterval = progressInterval;
+}
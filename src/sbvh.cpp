@@ -0,0 +1,350 @@
+#include "bvhnode.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "parallel.h"
+
+namespace {
+	struct Reference {
+		BoundingBox bbox;
+		uint32_t index;
+	};
+
+	struct Bin {
+		BoundingBox bbox = BoundingBox::empty();
+		size_t count = 0;
+		size_t entries = 0;
+		size_t exits = 0;
+	};
+
+	struct Split {
+		float cost = std::numeric_limits<float>::max();
+		int axis = -1;
+		float pos = 0;
+
+		// object splits partition by centroid bin, exactly as they were binned
+		int bin = 0;
+		float origin = 0;
+		float scale = 0;
+
+		BoundingBox left = BoundingBox::empty();
+		BoundingBox right = BoundingBox::empty();
+	};
+
+	inline BoundingBox intersection(const BoundingBox& a, const BoundingBox& b) {
+		return { glm::max(a.min, b.min), glm::min(a.max, b.max) };
+	}
+
+	// bounds of the part of the triangle between lo and hi along axis, limited to the reference bounds
+	BoundingBox clip(const Triangle& triangle, const BoundingBox& bbox, int axis, float lo, float hi) {
+		const glm::vec3* vertices[3] = { &triangle.v0->pos, &triangle.v1->pos, &triangle.v2->pos };
+		BoundingBox clipped = BoundingBox::empty();
+
+		for (int i=0; i<3; ++i) {
+			const glm::vec3& a = *vertices[i];
+			const glm::vec3& b = *vertices[(i + 1) % 3];
+
+			if (a[axis] >= lo && a[axis] <= hi) {
+				clipped.expand({ a, a });
+			}
+
+			for (float plane : { lo, hi }) {
+				if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+					glm::vec3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+					p[axis] = plane;
+					clipped.expand({ p, p });
+				}
+			}
+		}
+
+		return intersection(clipped, bbox);
+	}
+
+	class SpatialSplitBuilder {
+	private:
+		std::vector<Triangle>& triangles;
+		const BuildParams& params;
+		int binCount;
+		float minOverlap;
+
+		// leaves keep their references here until the tree is laid out depth first
+		std::mutex leafMutex;
+		std::vector<std::vector<uint32_t>> leafReferences;
+
+		std::unique_ptr<BvhNode> makeLeaf(const std::vector<Reference>& refs, const BoundingBox& bbox) {
+			auto node = std::make_unique<BvhNode>();
+			node->bbox = bbox;
+			node->count = static_cast<uint32_t>(refs.size());
+
+			std::vector<uint32_t> indices(refs.size());
+			for (size_t i=0; i<refs.size(); ++i) {
+				indices[i] = refs[i].index;
+			}
+
+			std::lock_guard<std::mutex> lg(leafMutex);
+			node->offset = static_cast<uint32_t>(leafReferences.size());
+			leafReferences.push_back(std::move(indices));
+
+			return node;
+		}
+
+		Split findObjectSplit(const std::vector<Reference>& refs, float area) const {
+			BoundingBox centroidBox = BoundingBox::empty();
+			for (const Reference& ref : refs) {
+				glm::vec3 centroid = ref.bbox.centroid();
+				centroidBox.expand({ centroid, centroid });
+			}
+
+			Split best;
+			std::vector<Bin> bins(static_cast<size_t>(binCount));
+			std::vector<BoundingBox> rightBoxes(static_cast<size_t>(binCount));
+			std::vector<size_t> rightCounts(static_cast<size_t>(binCount));
+
+			for (int axis=0; axis<3; ++axis) {
+				float extent = centroidBox.max[axis] - centroidBox.min[axis];
+				if (extent <= 0) continue;
+
+				float scale = binCount / extent;
+				std::fill(bins.begin(), bins.end(), Bin());
+
+				for (const Reference& ref : refs) {
+					int b = std::min(binCount - 1, static_cast<int>((ref.bbox.centroid()[axis] - centroidBox.min[axis]) * scale));
+					bins[b].bbox.expand(ref.bbox);
+					bins[b].count++;
+				}
+
+				BoundingBox right = BoundingBox::empty();
+				size_t rightCount = 0;
+				for (int b=binCount - 1; b > 0; --b) {
+					right.expand(bins[b].bbox);
+					rightCount += bins[b].count;
+					rightBoxes[b] = right;
+					rightCounts[b] = rightCount;
+				}
+
+				BoundingBox left = BoundingBox::empty();
+				size_t leftCount = 0;
+				for (int b=1; b < binCount; ++b) {
+					left.expand(bins[b - 1].bbox);
+					leftCount += bins[b - 1].count;
+
+					if (leftCount == 0 || rightCounts[b] == 0) continue;
+
+					float cost = params.traversalCost + params.intersectionCost * (left.area() * leftCount + rightBoxes[b].area() * rightCounts[b]) / area;
+
+					if (cost < best.cost) {
+						best.cost = cost;
+						best.axis = axis;
+						best.bin = b;
+						best.origin = centroidBox.min[axis];
+						best.scale = scale;
+						best.left = left;
+						best.right = rightBoxes[b];
+					}
+				}
+			}
+
+			return best;
+		}
+
+		Split findSpatialSplit(const std::vector<Reference>& refs, const BoundingBox& bbox, float area) const {
+			Split best;
+			std::vector<Bin> bins(static_cast<size_t>(binCount));
+			std::vector<BoundingBox> rightBoxes(static_cast<size_t>(binCount));
+			std::vector<size_t> rightCounts(static_cast<size_t>(binCount));
+
+			for (int axis=0; axis<3; ++axis) {
+				float extent = bbox.max[axis] - bbox.min[axis];
+				if (extent <= 0) continue;
+
+				float origin = bbox.min[axis];
+				float binSize = extent / binCount;
+				std::fill(bins.begin(), bins.end(), Bin());
+
+				// the same plane positions the split is made at, so that the rounding agrees with the partition
+				auto plane = [&] (int b) { return origin + b * binSize; };
+
+				for (const Reference& ref : refs) {
+					float lo = ref.bbox.min[axis], hi = ref.bbox.max[axis];
+
+					// binned like build partitions: right of a plane only if it ends past it, left if it starts
+					// before it or lies in it
+					int last = std::max(0, std::min(binCount - 1, static_cast<int>((hi - origin) / binSize)));
+					while (last > 0 && hi <= plane(last)) --last;
+					while (last < binCount - 1 && hi > plane(last + 1)) ++last;
+
+					int first = std::max(0, std::min(last, static_cast<int>((lo - origin) / binSize)));
+					while (first > 0 && lo < plane(first)) --first;
+					while (first < last && lo >= plane(first + 1)) ++first;
+
+					for (int b=first; b<=last; ++b) {
+						float binLo = b == first ? lo : plane(b);
+						float binHi = b == last ? hi : plane(b + 1);
+
+						bins[b].bbox.expand(first == last ? ref.bbox : clip(triangles[ref.index], ref.bbox, axis, binLo, binHi));
+					}
+
+					bins[first].entries++;
+					bins[last].exits++;
+				}
+
+				BoundingBox right = BoundingBox::empty();
+				size_t rightCount = 0;
+				for (int b=binCount - 1; b > 0; --b) {
+					right.expand(bins[b].bbox);
+					rightCount += bins[b].exits;
+					rightBoxes[b] = right;
+					rightCounts[b] = rightCount;
+				}
+
+				BoundingBox left = BoundingBox::empty();
+				size_t leftCount = 0;
+				for (int b=1; b < binCount; ++b) {
+					left.expand(bins[b - 1].bbox);
+					leftCount += bins[b - 1].entries;
+
+					if (leftCount == 0 || rightCounts[b] == 0) continue;
+					if (leftCount == refs.size() && rightCounts[b] == refs.size()) continue;
+
+					float cost = params.traversalCost + params.intersectionCost * (left.area() * leftCount + rightBoxes[b].area() * rightCounts[b]) / area;
+
+					if (cost < best.cost) {
+						best.cost = cost;
+						best.axis = axis;
+						best.pos = plane(b);
+						best.left = left;
+						best.right = rightBoxes[b];
+					}
+				}
+			}
+
+			return best;
+		}
+
+		std::unique_ptr<BvhNode> build(std::vector<Reference>& refs, const BoundingBox& bbox, int depth, unsigned threads) {
+			size_t count = refs.size();
+
+			if (count <= 1 || depth >= params.maxDepth) {
+				return makeLeaf(refs, bbox);
+			}
+
+			float area = bbox.area();
+			float leafCost = params.intersectionCost * count;
+
+			Split split;
+			bool spatial = false;
+
+			if (area > 0) {
+				split = findObjectSplit(refs, area);
+
+				// spatial splits only pay off where the object split children overlap noticeably
+				if (split.axis != -1 && intersection(split.left, split.right).area() > minOverlap) {
+					Split spatialSplit = findSpatialSplit(refs, bbox, area);
+
+					if (spatialSplit.cost < split.cost) {
+						split = spatialSplit;
+						spatial = true;
+					}
+				}
+			}
+
+			if (split.axis == -1 || (split.cost >= leafCost && count <= params.maxLeafSize)) {
+				return makeLeaf(refs, bbox);
+			}
+
+			std::vector<Reference> leftRefs, rightRefs;
+			BoundingBox leftBox = BoundingBox::empty(), rightBox = BoundingBox::empty();
+			int axis = split.axis;
+
+			for (const Reference& ref : refs) {
+				if (spatial) {
+					if (ref.bbox.max[axis] <= split.pos) {
+						leftRefs.push_back(ref);
+					} else if (ref.bbox.min[axis] >= split.pos) {
+						rightRefs.push_back(ref);
+					} else {
+						leftRefs.push_back({ clip(triangles[ref.index], ref.bbox, axis, ref.bbox.min[axis], split.pos), ref.index });
+						rightRefs.push_back({ clip(triangles[ref.index], ref.bbox, axis, split.pos, ref.bbox.max[axis]), ref.index });
+					}
+				} else if (std::min(binCount - 1, static_cast<int>((ref.bbox.centroid()[axis] - split.origin) * split.scale)) < split.bin) {
+					leftRefs.push_back(ref);
+				} else {
+					rightRefs.push_back(ref);
+				}
+			}
+
+			if (leftRefs.empty() || rightRefs.empty()) {
+				return makeLeaf(refs, bbox);
+			}
+
+			for (const Reference& ref : leftRefs) leftBox.expand(ref.bbox);
+			for (const Reference& ref : rightRefs) rightBox.expand(ref.bbox);
+
+			std::vector<Reference>().swap(refs);
+
+			auto node = std::make_unique<BvhNode>();
+			node->bbox = bbox;
+			node->axis = axis;
+
+			bool parallel = threads > 1 && count >= params.parallelCutoff;
+			unsigned rightThreads = parallel ? threads / 2 : 1;
+			unsigned leftThreads = parallel ? threads - rightThreads : threads;
+
+			parallelInvoke(parallel, [&] {
+				node->left = build(leftRefs, leftBox, depth + 1, leftThreads);
+			}, [&] {
+				node->right = build(rightRefs, rightBox, depth + 1, rightThreads);
+			});
+
+			return node;
+		}
+
+		void relayout(BvhNode& node, const std::vector<Triangle>& original) {
+			if (node.left) {
+				relayout(*node.left, original);
+				relayout(*node.right, original);
+			} else {
+				const std::vector<uint32_t>& indices = leafReferences[node.offset];
+
+				node.offset = static_cast<uint32_t>(triangles.size());
+				for (uint32_t index : indices) {
+					triangles.push_back(original[index]);
+				}
+			}
+		}
+
+	public:
+		SpatialSplitBuilder(std::vector<Triangle>& triangles, const BuildParams& params) : triangles(triangles), params(params) {
+			binCount = std::max(2, params.binCount);
+			minOverlap = 0;
+		}
+
+		std::unique_ptr<BvhNode> build() {
+			if (triangles.empty()) {
+				return std::make_unique<BvhNode>();
+			}
+
+			std::vector<Reference> refs(triangles.size());
+			BoundingBox bbox = BoundingBox::empty();
+			for (size_t i=0; i<triangles.size(); ++i) {
+				refs[i] = { BoundingBox::fromTriangle(triangles[i]), static_cast<uint32_t>(i) };
+				bbox.expand(refs[i].bbox);
+			}
+
+			minOverlap = params.sbvhAlpha * bbox.area();
+
+			auto root = build(refs, bbox, 0, std::max(1u, params.threadCount));
+
+			std::vector<Triangle> original;
+			original.swap(triangles);
+			relayout(*root, original);
+
+			return root;
+		}
+	};
+}
+
+std::unique_ptr<BvhNode> BvhNode::buildSbvh(std::vector<Triangle>& triangles, const BuildParams& params) {
+	return SpatialSplitBuilder(triangles, params).build();
+}
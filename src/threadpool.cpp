@@ -0,0 +1,149 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool* ThreadPool::global = nullptr;
+
+namespace {
+	// which pool the current thread works for and at which index, threads outside any pool use 0
+	thread_local const ThreadPool* currentPool = nullptr;
+	thread_local unsigned currentIndex = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+	for (unsigned i=0; i<std::max(1u, threadCount); ++i) {
+		workers.push_back(std::make_unique<Worker>());
+	}
+
+	for (unsigned i=1; i<workers.size(); ++i) {
+		threads.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lg(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	// only reached by tasks queued while the pool was shutting down
+	while (runTask(0));
+}
+
+unsigned ThreadPool::self() const {
+	return currentPool == this ? currentIndex : 0;
+}
+
+void ThreadPool::notify() {
+	// taking the lock orders this against sleepers checking their condition
+	{
+		std::lock_guard<std::mutex> lg(sleepMutex);
+	}
+	wakeUp.notify_all();
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> task) {
+	group.pending++;
+
+	Worker& worker = *workers[self()];
+	{
+		std::lock_guard<std::mutex> lg(worker.mutex);
+		worker.tasks.push_back({ std::move(task), &group });
+	}
+
+	queued++;
+	notify();
+}
+
+bool ThreadPool::runTask(unsigned index) {
+	Task task;
+	bool found = false;
+
+	// the newest task of our own deque is the one whose data is still in cache
+	{
+		Worker& worker = *workers[index];
+		std::lock_guard<std::mutex> lg(worker.mutex);
+
+		if (!worker.tasks.empty()) {
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// the oldest task of another deque is usually the largest piece of work left there
+	for (size_t i=1; i<workers.size() && !found; ++i) {
+		Worker& victim = *workers[(index + i) % workers.size()];
+		std::lock_guard<std::mutex> lg(victim.mutex);
+
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	queued--;
+
+	try {
+		task.function();
+	} catch (...) {
+		std::lock_guard<std::mutex> lg(task.group->errorMutex);
+		if (!task.group->error) {
+			task.group->error = std::current_exception();
+		}
+	}
+
+	// the group may be gone as soon as its count drops to zero
+	if (--task.group->pending == 0) {
+		notify();
+	}
+
+	return true;
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+	unsigned index = self();
+
+	while (group.pending > 0) {
+		if (runTask(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [&] { return group.pending == 0 || queued > 0; });
+	}
+
+	if (group.error) {
+		std::exception_ptr error = group.error;
+		group.error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+	currentPool = this;
+	currentIndex = index;
+
+	while (true) {
+		if (runTask(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [&] { return stopping || queued > 0; });
+
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
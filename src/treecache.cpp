@@ -0,0 +1,262 @@
+#include "treecache.h"
+
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	constexpr char magic[8] = { 'P', 'H', 'O', 'N', 'G', 'B', 'V', 'H' };
+	constexpr uint32_t version = 3;
+	constexpr uint64_t sectionAlignment = 64;
+
+	struct CacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint64_t key;
+		uint64_t nodeOffset;
+		uint64_t nodeCount;
+		uint64_t triangleOffset;
+		uint64_t triangleCount;
+		uint64_t recordOffset;
+		uint64_t vertexOffset;
+		uint64_t vertexCount;
+		uint32_t wideWidth;
+		uint32_t wideNodeBits;
+		uint32_t wideNodeSize;
+		uint32_t widePacketSize;
+		uint64_t wideNodeOffset;
+		uint64_t wideNodeCount;
+		uint64_t widePacketOffset;
+		uint64_t widePacketCount;
+		float buildCost;
+	};
+
+	inline uint64_t mix(uint64_t hash, uint64_t word) {
+		hash ^= word + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+		hash *= 0xFF51AFD7ED558CCDull;
+		return hash ^ (hash >> 32);
+	}
+
+	uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		size_t i = 0;
+
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, bytes + i, 8);
+			hash = mix(hash, word);
+		}
+
+		uint64_t tail = 0;
+		std::memcpy(&tail, bytes + i, size - i);
+
+		return mix(mix(hash, tail), size);
+	}
+
+	inline uint64_t align(uint64_t offset) {
+		return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+	}
+
+	// whether count items of size bytes at offset lie within the file, aligned like every section is saved
+	inline bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize) {
+		return offset % sectionAlignment == 0 && offset <= fileSize && (size == 0 || count <= (fileSize - offset) / size);
+	}
+}
+
+MappedFile::MappedFile(const std::string& fileName) {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("failed to open file '" + fileName + "'!");
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("failed to stat file '" + fileName + "'!");
+	}
+
+	size = static_cast<size_t>(st.st_size);
+	data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		throw std::runtime_error("failed to map file '" + fileName + "'!");
+	}
+}
+
+MappedFile::~MappedFile() {
+	munmap(data, size);
+}
+
+uint64_t TreeCache::hashFile(const std::string& fileName) {
+	MappedFile file(fileName);
+	return hashBytes(file.data, file.size, 0);
+}
+
+uint64_t TreeCache::key(uint64_t modelHash, const glm::mat4& transformation, const BuildParams& params) {
+	uint64_t hash = mix(modelHash, version);
+
+	for (int i=0; i<4; ++i) {
+		for (int j=0; j<4; ++j) {
+			float value = transformation[i][j];
+			hash = hashBytes(&value, sizeof(value), hash);
+		}
+	}
+
+	float floats[] = { params.traversalCost, params.intersectionCost, params.sbvhAlpha };
+	uint64_t ints[] = {
+		static_cast<uint64_t>(params.builder), params.maxLeafSize, static_cast<uint64_t>(params.maxDepth),
+		static_cast<uint64_t>(params.binCount), static_cast<uint64_t>(params.mortonBits), params.lbvhSahClusters,
+		static_cast<uint64_t>(params.treeletPasses), params.treeletMinTriangles
+	};
+
+	hash = hashBytes(floats, sizeof(floats), hash);
+	return hashBytes(ints, sizeof(ints), hash);
+}
+
+void TreeCache::prepareDirectory(const std::string& directory) {
+	if (mkdir(directory.c_str(), 0777) == -1 && errno != EEXIST) {
+		throw std::runtime_error("failed to create cache directory '" + directory + "'!");
+	}
+
+	struct stat st;
+	if (stat(directory.c_str(), &st) == -1 || !S_ISDIR(st.st_mode) || access(directory.c_str(), W_OK | X_OK) == -1) {
+		throw std::runtime_error("cache directory '" + directory + "' is not a writable directory!");
+	}
+}
+
+bool TreeCache::isValid(const FlatTree& tree) {
+	for (uint32_t triangle : tree.triangles) {
+		if (triangle >= tree.vertices.size() / 3) {
+			return false;
+		}
+	}
+
+	for (size_t i=0; i<tree.nodes.size(); ++i) {
+		const FlatNode& node = tree.nodes[i];
+
+		if (node.isLeaf()) {
+			if (static_cast<uint64_t>(node.offset) + node.count > tree.triangles.size()) {
+				return false;
+			}
+		} else if (node.axis > 2 || i + 1 >= tree.nodes.size() || node.offset <= i + 1 || node.offset >= tree.nodes.size()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool TreeCache::load(const std::string& fileName, uint64_t key, FlatTree& tree, WideSection& wide, float& buildCost) {
+	std::shared_ptr<MappedFile> mapping;
+
+	try {
+		mapping = std::make_shared<MappedFile>(fileName);
+	} catch (const std::runtime_error&) {
+		return false;
+	}
+
+	if (mapping->size < sizeof(CacheHeader)) {
+		return false;
+	}
+
+	char* base = static_cast<char*>(mapping->data);
+	const CacheHeader& header = *reinterpret_cast<const CacheHeader*>(base);
+
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.vertexSize != sizeof(Vertex) || header.key != key) {
+		return false;
+	}
+
+	if (!fits(header.nodeOffset, header.nodeCount, sizeof(FlatNode), mapping->size)
+		|| !fits(header.triangleOffset, header.triangleCount, sizeof(uint32_t), mapping->size)
+		|| !fits(header.recordOffset, header.triangleCount, sizeof(TriangleRecord), mapping->size)
+		|| !fits(header.vertexOffset, header.vertexCount, sizeof(Vertex), mapping->size)
+		|| !fits(header.wideNodeOffset, header.wideNodeCount, header.wideNodeSize, mapping->size)
+		|| !fits(header.widePacketOffset, header.widePacketCount, header.widePacketSize, mapping->size)) {
+		return false;
+	}
+
+	tree = FlatTree();
+	tree.nodes = { reinterpret_cast<FlatNode*>(base + header.nodeOffset), header.nodeCount };
+	tree.triangles = { reinterpret_cast<uint32_t*>(base + header.triangleOffset), header.triangleCount };
+	tree.records = { reinterpret_cast<TriangleRecord*>(base + header.recordOffset), header.triangleCount };
+	tree.vertices = { reinterpret_cast<const Vertex*>(base + header.vertexOffset), header.vertexCount };
+	tree.mapping = mapping;
+
+	if (!isValid(tree)) {
+		tree = FlatTree();
+		return false;
+	}
+
+	wide = WideSection();
+	if (header.wideWidth != 0) {
+		wide = {
+			header.wideWidth, header.wideNodeBits, header.wideNodeSize, header.widePacketSize,
+			base + header.wideNodeOffset, header.wideNodeCount, base + header.widePacketOffset, header.widePacketCount
+		};
+	}
+
+	buildCost = header.buildCost;
+
+	return true;
+}
+
+void TreeCache::save(const std::string& fileName, uint64_t key, const FlatTree& tree, const WideSection& wide, float buildCost) {
+	CacheHeader header {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.vertexSize = sizeof(Vertex);
+	header.key = key;
+	header.nodeOffset = align(sizeof(CacheHeader));
+	header.nodeCount = tree.nodes.size();
+	header.triangleOffset = align(header.nodeOffset + header.nodeCount * sizeof(FlatNode));
+	header.triangleCount = tree.triangles.size();
+	header.recordOffset = align(header.triangleOffset + header.triangleCount * sizeof(uint32_t));
+	header.vertexOffset = align(header.recordOffset + header.triangleCount * sizeof(TriangleRecord));
+	header.vertexCount = tree.vertices.size();
+	header.wideWidth = wide.width;
+	header.wideNodeBits = wide.nodeBits;
+	header.wideNodeSize = wide.nodeSize;
+	header.widePacketSize = wide.packetSize;
+	header.wideNodeOffset = align(header.vertexOffset + header.vertexCount * sizeof(Vertex));
+	header.wideNodeCount = wide.nodeCount;
+	header.widePacketOffset = align(header.wideNodeOffset + header.wideNodeCount * header.wideNodeSize);
+	header.widePacketCount = wide.packetCount;
+	header.buildCost = buildCost;
+
+	// written aside and renamed, so that concurrent runs never map a partial file
+	std::string tmpFileName = fileName + "." + std::to_string(getpid()) + ".tmp";
+	std::ofstream file(tmpFileName, std::ios::binary);
+
+	if (!file) {
+		throw std::runtime_error("failed to open file '" + tmpFileName + "'!");
+	}
+
+	auto writeAt = [&file] (uint64_t offset, const void* data, size_t size) {
+		static const char padding[sectionAlignment] = {};
+
+		file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	};
+
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.nodeOffset, tree.nodes.data(), header.nodeCount * sizeof(FlatNode));
+	writeAt(header.triangleOffset, tree.triangles.data(), header.triangleCount * sizeof(uint32_t));
+	writeAt(header.recordOffset, tree.records.data(), header.triangleCount * sizeof(TriangleRecord));
+	writeAt(header.vertexOffset, tree.vertices.data(), header.vertexCount * sizeof(Vertex));
+	writeAt(header.wideNodeOffset, wide.nodes, header.wideNodeCount * header.wideNodeSize);
+	writeAt(header.widePacketOffset, wide.packets, header.widePacketCount * header.widePacketSize);
+	file.close();
+
+	if (!file || std::rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+		std::remove(tmpFileName.c_str());
+		throw std::runtime_error("failed to write file '" + fileName + "'!");
+	}
+}
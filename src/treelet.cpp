@@ -0,0 +1,239 @@
+#include "treelet.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#include "kdnode.h"
+#include "bvhnode.h"
+#include "parallel.h"
+
+namespace {
+	constexpr int maxTreeletLeaves = 7;
+	constexpr int subsetCount = 1 << maxTreeletLeaves;
+
+	template<typename Node>
+	float subtreeCost(const Node& node, const BuildParams& params) {
+		if (!node.left) {
+			return params.intersectionCost * node.bbox.area() * node.count;
+		}
+
+		return params.traversalCost * node.bbox.area() + subtreeCost(*node.left, params) + subtreeCost(*node.right, params);
+	}
+
+	template<typename Node>
+	size_t leafTriangles(const Node& node) {
+		return node.left ? leafTriangles(*node.left) + leafTriangles(*node.right) : node.count;
+	}
+
+	template<typename Node>
+	class TreeletOptimizer {
+	private:
+		const BuildParams& params;
+
+		struct Treelet {
+			std::array<std::unique_ptr<Node>*, maxTreeletLeaves> leaves;
+			std::array<float, maxTreeletLeaves> leafCosts;
+			int leafCount = 0;
+
+			// interior nodes below the treelet root, reused for the new topology
+			std::vector<std::unique_ptr<Node>*> interior;
+		};
+
+		struct Subsets {
+			std::array<BoundingBox, subsetCount> bboxes;
+			std::array<float, subsetCount> costs;
+			std::array<int, subsetCount> partitions;
+		};
+
+		static int dominantAxis(const Node& left, const Node& right) {
+			glm::vec3 d = glm::abs(left.bbox.centroid() - right.bbox.centroid());
+			return d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+		}
+
+		float leafCost(const Node& node) const {
+			return params.intersectionCost * node.bbox.area() * node.count;
+		}
+
+		Treelet formTreelet(Node& root) const {
+			Treelet treelet;
+			treelet.leaves[0] = &root.left;
+			treelet.leaves[1] = &root.right;
+			treelet.leafCount = 2;
+
+			// keep opening the treelet leaf with the largest surface area
+			while (treelet.leafCount < maxTreeletLeaves) {
+				int best = -1;
+				float bestArea = -1;
+
+				for (int i=0; i<treelet.leafCount; ++i) {
+					const Node& leaf = **treelet.leaves[i];
+
+					if (leaf.left && leaf.bbox.area() > bestArea) {
+						bestArea = leaf.bbox.area();
+						best = i;
+					}
+				}
+
+				if (best == -1) break;
+
+				std::unique_ptr<Node>* opened = treelet.leaves[best];
+				treelet.interior.push_back(opened);
+				treelet.leaves[best] = &(*opened)->left;
+				treelet.leaves[treelet.leafCount++] = &(*opened)->right;
+			}
+
+			for (int i=0; i<treelet.leafCount; ++i) {
+				treelet.leafCosts[i] = (*treelet.leaves[i])->cost;
+			}
+
+			return treelet;
+		}
+
+		void solve(const Treelet& treelet, Subsets& subsets) const {
+			int full = (1 << treelet.leafCount) - 1;
+
+			for (int s=1; s<=full; ++s) {
+				subsets.bboxes[s] = BoundingBox::empty();
+				for (int i=0; i<treelet.leafCount; ++i) {
+					if (s & (1 << i)) {
+						subsets.bboxes[s].expand((*treelet.leaves[i])->bbox);
+					}
+				}
+			}
+
+			for (int i=0; i<treelet.leafCount; ++i) {
+				subsets.costs[1 << i] = treelet.leafCosts[i];
+			}
+
+			// subsets only ever partition into smaller subsets, so increasing order is enough
+			for (int s=1; s<=full; ++s) {
+				if ((s & (s - 1)) == 0) continue;
+
+				float best = std::numeric_limits<float>::max();
+				int lowest = s & -s;
+
+				// every partition is only visited once, with the lowest leaf on the left
+				for (int p=(s - 1) & s; p > 0; p = (p - 1) & s) {
+					if (!(p & lowest)) continue;
+
+					float cost = subsets.costs[p] + subsets.costs[s ^ p];
+					if (cost < best) {
+						best = cost;
+						subsets.partitions[s] = p;
+					}
+				}
+
+				subsets.costs[s] = params.traversalCost * subsets.bboxes[s].area() + best;
+			}
+		}
+
+		std::unique_ptr<Node> rebuild(int s, const Subsets& subsets, std::array<std::unique_ptr<Node>, maxTreeletLeaves>& leaves, std::vector<std::unique_ptr<Node>>& pool) const {
+			if ((s & (s - 1)) == 0) {
+				return std::move(leaves[__builtin_ctz(static_cast<unsigned>(s))]);
+			}
+
+			std::unique_ptr<Node> node = std::move(pool.back());
+			pool.pop_back();
+
+			node->left = rebuild(subsets.partitions[s], subsets, leaves, pool);
+			node->right = rebuild(s ^ subsets.partitions[s], subsets, leaves, pool);
+			node->bbox = subsets.bboxes[s];
+			node->axis = dominantAxis(*node->left, *node->right);
+			node->cost = subsets.costs[s];
+
+			return node;
+		}
+
+		void restructure(Node& root) const {
+			Treelet treelet = formTreelet(root);
+
+			if (treelet.leafCount < 3) {
+				return;
+			}
+
+			Subsets subsets;
+			solve(treelet, subsets);
+
+			int full = (1 << treelet.leafCount) - 1;
+			if (subsets.costs[full] >= root.cost * 0.999f) {
+				return;
+			}
+
+			std::array<std::unique_ptr<Node>, maxTreeletLeaves> leaves;
+			for (int i=0; i<treelet.leafCount; ++i) {
+				leaves[i] = std::move(*treelet.leaves[i]);
+			}
+
+			// the leaves are detached, so interior nodes can be taken deepest first without losing any subtree
+			std::vector<std::unique_ptr<Node>> pool;
+			for (auto it = treelet.interior.rbegin(); it != treelet.interior.rend(); ++it) {
+				pool.push_back(std::move(**it));
+			}
+
+			root.left = rebuild(subsets.partitions[full], subsets, leaves, pool);
+			root.right = rebuild(full ^ subsets.partitions[full], subsets, leaves, pool);
+			root.axis = dominantAxis(*root.left, *root.right);
+			root.cost = subsets.costs[full];
+		}
+
+		// bottom up over the subtree, returns its triangle count
+		size_t optimize(Node& node, unsigned threads) const {
+			if (!node.left) {
+				node.cost = leafCost(node);
+				return node.count;
+			}
+
+			size_t left, right;
+			bool parallel = threads > 1;
+			unsigned rightThreads = parallel ? threads / 2 : 1;
+			unsigned leftThreads = parallel ? threads - rightThreads : threads;
+
+			parallelInvoke(parallel, [&] {
+				left = optimize(*node.left, leftThreads);
+			}, [&] {
+				right = optimize(*node.right, rightThreads);
+			});
+
+			size_t count = left + right;
+			node.cost = params.traversalCost * node.bbox.area() + node.left->cost + node.right->cost;
+
+			// small subtrees are left alone, most of the traversal time is spent above them
+			if (count >= params.treeletMinTriangles) {
+				restructure(node);
+			}
+
+			return count;
+		}
+
+	public:
+		TreeletOptimizer(const BuildParams& params) : params(params) {}
+
+		void optimize(Node& root, size_t triangleCount) const {
+			optimize(root, triangleCount >= params.parallelCutoff ? std::max(1u, params.threadCount) : 1);
+		}
+	};
+}
+
+template<typename Node>
+float sahCost(const Node& node, const BuildParams& params) {
+	float area = node.bbox.area();
+	return area > 0 ? subtreeCost(node, params) / area : 0;
+}
+
+template<typename Node>
+float optimizeTreelets(Node& root, const BuildParams& params) {
+	TreeletOptimizer<Node> optimizer(params);
+	size_t triangleCount = leafTriangles(root);
+
+	for (int pass=0; pass<params.treeletPasses; ++pass) {
+		optimizer.optimize(root, triangleCount);
+	}
+
+	return sahCost(root, params);
+}
+
+template float sahCost(const KdNode&, const BuildParams&);
+template float sahCost(const BvhNode&, const BuildParams&);
+template float optimizeTreelets(KdNode&, const BuildParams&);
+template float optimizeTreelets(BvhNode&, const BuildParams&);
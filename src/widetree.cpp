@@ -0,0 +1,160 @@
+#include "widetree.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+template<int Width>
+void WideNode<Width, float>::setBounds(const BoundingBox* boxes, int count) {
+	for (int i=0; i<Width; ++i) {
+		// no ray ever enters an empty slot
+		BoundingBox bbox = i < count ? boxes[i] : BoundingBox::empty();
+
+		for (int axis=0; axis<3; ++axis) {
+			bounds[2 * axis][i] = bbox.min[axis];
+			bounds[2 * axis + 1][i] = bbox.max[axis];
+		}
+	}
+}
+
+template<int Width, typename Bound>
+void WideNode<Width, Bound>::setBounds(const BoundingBox* boxes, int count) {
+	const int levels = std::numeric_limits<Bound>::max();
+
+	BoundingBox node = BoundingBox::empty();
+	for (int i=0; i<count; ++i) {
+		node.expand(boxes[i]);
+	}
+
+	for (int axis=0; axis<3; ++axis) {
+		origin[axis] = node.min[axis] <= node.max[axis] ? node.min[axis] : 0;
+
+		// the smallest step whose top level lies strictly beyond the node, which also leaves
+		// empty slots inverted along axes where the node is flat
+		float extent = node.max[axis] - node.min[axis];
+		int steps = extent > 0 ? std::max(-126, std::ilogb(extent / levels)) : -126;
+		for (exponent[axis] = static_cast<int8_t>(steps); decode(axis, levels) <= node.max[axis]; ++exponent[axis]);
+
+		for (int i=0; i<Width; ++i) {
+			int lo = levels, hi = 0;
+
+			if (i < count && boxes[i].min[axis] <= boxes[i].max[axis]) {
+				float min = boxes[i].min[axis], max = boxes[i].max[axis];
+				lo = std::min(levels, std::max(0, static_cast<int>(std::floor((min - origin[axis]) / scale(axis)))));
+				hi = std::min(levels, std::max(0, static_cast<int>(std::ceil((max - origin[axis]) / scale(axis)))));
+
+				// the division rounds, decoding is what the traversal sees
+				for (; lo > 0 && decode(axis, lo) > min; --lo);
+				for (; hi < levels && decode(axis, hi) < max; ++hi);
+			}
+
+			bounds[2 * axis][i] = static_cast<Bound>(lo);
+			bounds[2 * axis + 1][i] = static_cast<Bound>(hi);
+		}
+	}
+}
+
+template<int Width, typename Bound>
+WideTree<Width, Bound> WideTree<Width, Bound>::collapse(const FlatTree& tree) {
+	WideTree wide;
+	wide.triangles = tree.triangles;
+	wide.vertices = tree.vertices;
+
+	if (!tree.nodes.empty()) {
+		wide.bbox = tree.nodes[0].bbox;
+		wide.collapseNode(tree, 0);
+	}
+
+	wide.nodes = { wide.nodeStorage.data(), wide.nodeStorage.size() };
+	wide.packets = { wide.packetStorage.data(), wide.packetStorage.size() };
+
+	return wide;
+}
+
+template<int Width, typename Bound>
+uint32_t WideTree<Width, Bound>::collapseNode(const FlatTree& tree, uint32_t index) {
+	// a leaf root still needs a node holding it
+	uint32_t children[Width] = { index };
+	int childCount = 1;
+
+	if (!tree.nodes[index].isLeaf()) {
+		children[0] = index + 1;
+		children[1] = tree.nodes[index].offset;
+		childCount = 2;
+	}
+
+	while (childCount < Width) {
+		int largest = -1;
+		float largestArea = -1;
+
+		for (int i=0; i<childCount; ++i) {
+			const FlatNode& child = tree.nodes[children[i]];
+
+			if (!child.isLeaf() && child.bbox.area() > largestArea) {
+				largest = i;
+				largestArea = child.bbox.area();
+			}
+		}
+
+		if (largest == -1) break;
+
+		const FlatNode& child = tree.nodes[children[largest]];
+		children[childCount++] = child.offset;
+		children[largest] = children[largest] + 1;
+	}
+
+	uint32_t wideIndex = static_cast<uint32_t>(nodeStorage.size());
+	nodeStorage.emplace_back();
+
+	BoundingBox boxes[Width];
+	for (int i=0; i<Width; ++i) {
+		uint32_t offset = 0;
+		uint16_t count = 0;
+
+		if (i < childCount) {
+			const FlatNode& child = tree.nodes[children[i]];
+			boxes[i] = child.bbox;
+
+			if (child.isLeaf()) {
+				offset = packLeaf(tree, child.offset, child.count);
+				count = child.count;
+			} else {
+				offset = collapseNode(tree, children[i]);
+			}
+		}
+
+		nodeStorage[wideIndex].offset[i] = offset;
+		nodeStorage[wideIndex].count[i] = count;
+	}
+	nodeStorage[wideIndex].setBounds(boxes, childCount);
+
+	return wideIndex;
+}
+
+template<int Width, typename Bound>
+uint32_t WideTree<Width, Bound>::packLeaf(const FlatTree& tree, uint32_t offset, uint32_t count) {
+	uint32_t first = static_cast<uint32_t>(packetStorage.size());
+	packetStorage.resize(first + (count + Width - 1) / Width);
+
+	for (uint32_t i=0; i<count; ++i) {
+		TrianglePacket<Width>& packet = packetStorage[first + i / Width];
+		const TriangleRecord& record = tree.records[offset + i];
+		int lane = i % Width;
+
+		for (int axis=0; axis<3; ++axis) {
+			packet.v0[axis][lane] = record.v0[axis];
+			packet.e1[axis][lane] = record.e1[axis];
+			packet.e2[axis][lane] = record.e2[axis];
+		}
+		packet.reference[lane] = offset + i;
+	}
+
+	return first;
+}
+
+template struct WideTree<4>;
+template struct WideTree<8>;
+template struct WideTree<4, uint8_t>;
+template struct WideTree<4, uint16_t>;
+template struct WideTree<8, uint8_t>;
+template struct WideTree<8, uint16_t>;
@@ -0,0 +1,89 @@
+#include "workqueue.h"
+
+#include <algorithm>
+
+WorkQueue::WorkQueue(size_t count, unsigned workers) : count(count), ranges(std::max(1u, workers)) {}
+
+bool WorkQueue::next(unsigned worker, size_t& item) {
+	Range& own = ranges[worker];
+
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lg(own.mutex);
+
+			if (own.begin < own.end) {
+				item = own.begin++;
+				return true;
+			}
+		}
+
+		if (!claim(worker) && !steal(worker)) {
+			return false;
+		}
+	}
+}
+
+bool WorkQueue::claim(unsigned worker) {
+	size_t begin = claimed.load(std::memory_order_relaxed);
+	size_t size;
+
+	// half of an even share of what is left, the last ranges are single items
+	do {
+		if (begin >= count) {
+			return false;
+		}
+
+		size = std::max<size_t>(1, (count - begin) / (2 * ranges.size()));
+	} while (!claimed.compare_exchange_weak(begin, begin + size));
+
+	Range& own = ranges[worker];
+	std::lock_guard<std::mutex> lg(own.mutex);
+	own.begin = begin;
+	own.end = std::min(count, begin + size);
+
+	return true;
+}
+
+bool WorkQueue::steal(unsigned worker) {
+	while (true) {
+		// the sizes are only a hint, the victim is checked again under its lock
+		size_t largest = 0;
+		Range* victim = nullptr;
+
+		for (size_t i=0; i<ranges.size(); ++i) {
+			Range& range = ranges[i];
+
+			std::lock_guard<std::mutex> lg(range.mutex);
+			if (i != worker && range.end - range.begin > largest) {
+				largest = range.end - range.begin;
+				victim = &range;
+			}
+		}
+
+		if (!victim) {
+			return false;
+		}
+
+		size_t begin, end;
+		{
+			std::lock_guard<std::mutex> lg(victim->mutex);
+
+			// emptied since the scan, look again
+			if (victim->begin == victim->end) {
+				continue;
+			}
+
+			// a single item left is taken whole, its owner is still busy with the one before
+			end = victim->end;
+			begin = victim->begin + (victim->end - victim->begin) / 2;
+			victim->end = begin;
+		}
+
+		Range& own = ranges[worker];
+		std::lock_guard<std::mutex> lg(own.mutex);
+		own.begin = begin;
+		own.end = end;
+
+		return true;
+	}
+}